@@ -0,0 +1,849 @@
+// logbench.cpp : End-to-end benchmark of tailer.  Synthetic writers append log lines to a set of
+// files while tailer watches them, or a captured directory of real logs is replayed at the pace
+// of its timestamps; the lines tailer prints are read back from its stdout to measure
+// throughput, lost and duplicated lines and the write-to-print latency.
+//
+
+#include <filesystem>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <Windows.h>
+#include <psapi.h>
+#include "../tailer/Args.h"
+#include "../tailer/unique_handle.h"
+#include "../tailer/LatencyHistogram.h"
+#include "../tailer/LogLayout.h"
+
+namespace fs = std::experimental::filesystem::v1;
+
+///////////////////////////////////////////////////////////////////////////////
+// constants
+//
+
+/** tailer's file name pattern for the synthetic files: bench<file>_<generation>.log */
+const char FILE_PATTERN[]{ "(bench\\d+)_\\d+\\.log" };
+
+/** size of the buffer tailer's output is read into */
+const DWORD PIPE_READ_LEN{ 64 * 1024 };
+
+/** time tailer gets to print the last lines after the writers stop */
+const DWORD DRAIN_MILLIS{ 10000 };
+
+/** time tailer gets to start watching the files before the writers start */
+const DWORD STARTUP_MILLIS{ 2000 };
+
+/** tailer's default file name pattern, used to find the files of a captured directory */
+const char REPLAY_PATTERN[]{ "(ess.*|tfe.*)_\\d+\\.log" };
+
+/** tailer's default beep pattern, whose hit rate on the replayed lines is reported */
+const char BEEP_PATTERN[]{ ".*[a-zA-Z]+\\.[a-zA-Z]+(Exception|Error):" };
+
+/** replayed lines that are due together are written in batches of up to this size */
+const size_t REPLAY_BATCH_LEN{ 64 * 1024 };
+
+/** longest sleep of a replay writer, so it notices when the benchmark is stopped */
+const DWORD REPLAY_SLEEP_MILLIS{ 100 };
+
+///////////////////////////////////////////////////////////////////////////////
+// types
+//
+
+/**
+  Policy object for unique_handle when dealing with generic handle returned from
+  CreateFile or any other call that uses the CloseHandle call to dispose.
+*/
+struct GenericHandlePolicy {
+   typedef HANDLE handle_type;
+   static void close(handle_type handle) {
+      if (handle != NULL && handle != INVALID_HANDLE_VALUE) {
+         CloseHandle(handle);
+      }
+   }
+   static handle_type get_null() { return NULL; }
+   static bool is_null(handle_type handle) {  return handle == NULL; }
+};
+
+/** benchmark settings */
+struct BenchOptions {
+   fs::path tailer;
+   std::string tailerArgs;
+   fs::path dir;
+   unsigned files;
+   unsigned rate;             // lines per second per file
+   unsigned minLineLen;
+   unsigned maxLineLen;
+   bool exponential;          // line lengths are exponentially rather than uniformly distributed
+   uint64_t rotateBytes;      // 0 = never rotated
+   unsigned seconds;          // 0 = until the replay ends
+   fs::path replayDir;        // empty for synthetic writers
+   std::string replayPattern;
+   std::string timestampFormat;
+   std::string beepPattern;
+   double speed;              // replay speed relative to the timestamps, 0 = as fast as possible
+};
+
+/** the captured files of one prefix, replayed one after the other like the original rotation */
+struct ReplayStream {
+   std::string prefix;
+   std::vector<fs::path> files;                 // in the order they were written
+   size_t lines{0};                             // lines in all of the files
+   std::vector<std::pair<size_t, size_t>> index;   // hash of each line's text and its line number, sorted
+   std::vector<bool> beeps;                     // whether each line matches the beep pattern
+   std::unique_ptr<int64_t[]> sent;             // performance counter when each line was written
+   std::atomic<size_t> written{0};              // lines written (and stamped in 'sent') so far
+   std::unordered_map<size_t, size_t> printedByHash;   // how many lines with each hash were printed
+   std::vector<bool> printed;                   // whether each line was printed
+   size_t printedLines{0};                      // lines read back from tailer's output with the stream's label
+   size_t duplicated{0};                        // printed lines whose every copy had already been printed
+   size_t unmatched{0};                         // printed lines that match no line in the capture
+};
+
+/** what one writer thread did */
+struct WriterResult {
+   uint64_t lines{0};
+   uint64_t bytes{0};
+   unsigned rotations{0};
+   bool failed{false};
+};
+
+/** what was read back from tailer's output */
+struct ReaderResult {
+   std::vector<std::vector<unsigned char>> seen;   // per file, the number of times each line was printed
+   std::unordered_map<std::string, ReplayStream *> replayLabels;   // "prefix: " -> stream, when replaying
+   std::atomic<uint64_t> lines{0};
+   uint64_t bytes{0};
+   LatencyHistogram latency;                       // write-to-print latency in nanoseconds
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// utility functions
+//
+
+int64_t perf_counter() {
+   LARGE_INTEGER counter;
+   QueryPerformanceCounter(&counter);
+   return counter.QuadPart;
+}
+
+/** nanoseconds in a difference between two values of the performance counter */
+uint64_t perf_nanos(int64_t ticks) {
+   static const double nanosPerTick = [] {
+      LARGE_INTEGER freq;
+      return QueryPerformanceFrequency(&freq) && freq.QuadPart > 0 ? 1e9 / freq.QuadPart : 1.0;
+   }();
+   return ticks > 0 ? (uint64_t)(ticks * nanosPerTick) : 0;
+}
+
+std::string get_last_error() {
+   DWORD err = GetLastError();
+   std::ostringstream os;
+   os << err;
+   return os.str();
+}
+
+/** the string as a quoted JSON string */
+std::string json_string(const std::string &str) {
+   std::string quoted("\"");
+   for (char c : str) {
+      if (c == '"' || c == '\\') {
+         quoted += '\\';
+         quoted += c;
+      } else if ((unsigned char)c < 0x20) {
+         char escape[8];
+         snprintf(escape, sizeof(escape), "\\u%04x", (unsigned char)c);
+         quoted += escape;
+      } else {
+         quoted += c;
+      }
+   }
+   return quoted + '"';
+}
+
+/** hash of a line's text without its carriage return, which tailer doesn't print either */
+size_t line_hash(const char *line, size_t len) {
+   if (len > 0 && line[len - 1] == '\r') {
+      --len;
+   }
+   return std::hash<std::string_view>()(std::string_view(line, len));
+}
+
+fs::path file_path(const fs::path &dir, unsigned file, unsigned generation) {
+   return dir / ("bench" + std::to_string(file) + "_" + std::to_string(generation) + ".log");
+}
+
+/** local time in tailer's default timestamp format, e.g. 2022-02-16 18:51:11,673 */
+void format_timestamp(char *buf, size_t len) {
+   SYSTEMTIME st;
+   GetLocalTime(&st);
+   snprintf(buf, len, "%04u-%02u-%02u %02u:%02u:%02u,%03u", st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond, st.wMilliseconds);
+}
+
+unique_handle<GenericHandlePolicy> create_log_file(const fs::path &path) {
+   return unique_handle<GenericHandlePolicy>(CreateFile(path.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                                        NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// writers and reader
+//
+
+/**
+ * Appends 'rate' lines per second to one file until 'stop' is set.  Each line carries the file
+ * and line number and the performance counter when it was written, e.g.
+ *
+ *    2022-02-16 18:51:11,673 INFO [writer3] - seq=3:1234 sent=123456789 xxxxxxxx...
+ *
+ * Lines are written one WriteFile call at a time, like a logger that flushes every line.  With
+ * rotation the file is closed once it reaches the size limit and the writer continues in the file
+ * with the next generation number.
+ */
+void writeLines(const BenchOptions &opts, unsigned file, std::atomic<bool> &stop, WriterResult &result) {
+   std::mt19937 random(12345 + file);
+   std::uniform_int_distribution<unsigned> uniformLen(opts.minLineLen, opts.maxLineLen);
+   std::exponential_distribution<double> exponentialLen(1.0 / std::max(1u, opts.minLineLen));
+   unsigned generation = 0;
+   unique_handle<GenericHandlePolicy> handle(create_log_file(file_path(opts.dir, file, generation)));
+   uint64_t fileBytes = 0;
+   LARGE_INTEGER freq;
+   QueryPerformanceFrequency(&freq);
+   int64_t start = perf_counter();
+   std::string line;
+   char timestamp[32];
+   while (!stop.load() && handle) {
+      // write every line that is due, then wait for the next one
+      uint64_t due = (uint64_t)((perf_counter() - start) * (double)opts.rate / freq.QuadPart);
+      if (result.lines >= due) {
+         Sleep(1);
+         continue;
+      }
+      format_timestamp(timestamp, sizeof(timestamp));
+      line = timestamp;
+      line += " INFO [writer" + std::to_string(file) + "] - seq=" + std::to_string(file) + ":" + std::to_string(result.lines)
+              + " sent=" + std::to_string(perf_counter()) + " ";
+      unsigned len = opts.exponential ? std::min(opts.maxLineLen, (unsigned)exponentialLen(random)) : uniformLen(random);
+      if (line.size() < len) {
+         line.append(len - line.size(), 'x');
+      }
+      line += "\r\n";
+      DWORD written = 0;
+      if (!WriteFile(handle.get(), line.data(), (DWORD)line.size(), &written, NULL) || written != line.size()) {
+         result.failed = true;
+         break;
+      }
+      result.lines++;
+      result.bytes += line.size();
+      fileBytes += line.size();
+      if (opts.rotateBytes > 0 && fileBytes >= opts.rotateBytes) {
+         handle.reset(create_log_file(file_path(opts.dir, file, ++generation)).release());
+         fileBytes = 0;
+         result.rotations++;
+      }
+   }
+   if (!handle) {
+      result.failed = true;
+   }
+}
+
+/**
+ * Finds the files of a captured log directory that match the replay pattern and groups them by
+ * prefix, oldest first, indexing every line by the hash of its text so the printed lines can be
+ * matched to it.  'captureFiles' is set to the number of files in the directory.  Returns the
+ * earliest timestamp in the capture, or INT64_MAX if no line has a timestamp.
+ */
+int64_t loadCapture(const BenchOptions &opts, std::vector<std::unique_ptr<ReplayStream>> &streams, size_t &captureFiles) {
+   std::regex pattern(opts.replayPattern);
+   std::regex beep(opts.beepPattern);
+   TimestampFormat format(opts.timestampFormat);
+   std::unordered_map<std::string, std::vector<std::pair<fs::file_time_type, fs::path>>> prefixFiles;
+   std::smatch match;
+   captureFiles = 0;
+   for (auto &entry : fs::directory_iterator(opts.replayDir)) {
+      if (fs::is_directory(entry.status())) {
+         continue;
+      }
+      captureFiles++;
+      std::string name = entry.path().filename().string();
+      if (std::regex_search(name, match, pattern) && match[1].length() > 0) {
+         prefixFiles[match[1]].emplace_back(fs::last_write_time(entry.path()), entry.path());
+      }
+   }
+   int64_t firstTimestamp = INT64_MAX;
+   for (auto &prefix : prefixFiles) {
+      std::unique_ptr<ReplayStream> stream(new ReplayStream);
+      stream->prefix = prefix.first;
+      std::sort(prefix.second.begin(), prefix.second.end());
+      bool timestamped = false;
+      for (auto &file : prefix.second) {
+         stream->files.push_back(file.second);
+         std::ifstream in(file.second, std::ios::binary);
+         std::string line;
+         while (std::getline(in, line)) {
+            int64_t timestamp;
+            if (!timestamped && format.parse(line.data(), line.size(), timestamp)) {
+               firstTimestamp = std::min(firstTimestamp, timestamp);
+               timestamped = true;
+            }
+            stream->index.emplace_back(line_hash(line.data(), line.size()), stream->lines);
+            stream->beeps.push_back(std::regex_search(line, beep));
+            stream->lines++;
+         }
+      }
+      std::sort(stream->index.begin(), stream->index.end());
+      stream->printed.resize(stream->lines);
+      stream->sent.reset(new int64_t[stream->lines + 1]());
+      streams.push_back(std::move(stream));
+   }
+   return firstTimestamp;
+}
+
+/** writes the batched lines and stamps them with the time they were written */
+bool flushReplayBatch(HANDLE handle, std::string &batch, ReplayStream &stream, WriterResult &result) {
+   if (batch.empty()) {
+      return true;
+   }
+   DWORD written = 0;
+   if (!WriteFile(handle, batch.data(), (DWORD)batch.size(), &written, NULL) || written != batch.size()) {
+      return false;
+   }
+   int64_t now = perf_counter();
+   size_t first = stream.written.load(std::memory_order_relaxed);
+   size_t count = std::count(batch.begin(), batch.end(), '\n');
+   for (size_t i = first; i < first + count && i < stream.lines; i++) {
+      stream.sent[i] = now;
+   }
+   stream.written.store(std::min(first + count, stream.lines), std::memory_order_release);
+   result.lines += count;
+   result.bytes += batch.size();
+   batch.clear();
+   return true;
+}
+
+/**
+ * Replays the captured files of one prefix into the benchmark directory under their original
+ * names.  Each line is written when its timestamp is due -- 'firstTimestamp' corresponds to
+ * 'start' and time runs 'speed' times as fast -- and lines without a timestamp follow the line
+ * before them.  At speed 0 the lines are written as fast as possible.  Every file is started
+ * after the previous one is complete, so the files rotate where the originals did.
+ */
+void replayLines(const BenchOptions &opts, ReplayStream &stream, int64_t firstTimestamp, int64_t start, std::atomic<bool> &stop,
+                 WriterResult &result) {
+   TimestampFormat format(opts.timestampFormat);
+   LARGE_INTEGER freq;
+   QueryPerformanceFrequency(&freq);
+   const double ticksPerMilli = freq.QuadPart / 1000.0;
+   int64_t timestamp = firstTimestamp;
+   std::string batch;
+   std::string line;
+   for (size_t f = 0; f < stream.files.size() && !stop.load(); f++) {
+      unique_handle<GenericHandlePolicy> handle(create_log_file(opts.dir / stream.files[f].filename()));
+      if (!handle) {
+         result.failed = true;
+         return;
+      }
+      if (f > 0) {
+         result.rotations++;
+      }
+      std::ifstream in(stream.files[f], std::ios::binary);
+      while (!stop.load() && std::getline(in, line)) {
+         if (opts.speed > 0) {
+            int64_t lineTimestamp;
+            if (format.parse(line.data(), line.size(), lineTimestamp)) {
+               timestamp = std::max(timestamp, lineTimestamp);
+            }
+            int64_t due = start + (int64_t)((timestamp - firstTimestamp) * ticksPerMilli / opts.speed);
+            if (due > perf_counter()) {
+               if (!flushReplayBatch(handle.get(), batch, stream, result)) {
+                  result.failed = true;
+                  return;
+               }
+               for (int64_t now = perf_counter(); now < due && !stop.load(); now = perf_counter()) {
+                  Sleep(std::min(REPLAY_SLEEP_MILLIS, (DWORD)((due - now) / ticksPerMilli) + 1));
+               }
+            }
+         }
+         batch += line;
+         batch += '\n';
+         if (batch.size() >= REPLAY_BATCH_LEN && !flushReplayBatch(handle.get(), batch, stream, result)) {
+            result.failed = true;
+            return;
+         }
+      }
+      if (!flushReplayBatch(handle.get(), batch, stream, result)) {
+         result.failed = true;
+         return;
+      }
+   }
+}
+
+/**
+ * Counts a replayed line printed by tailer, matching it by its text to a line of the stream whose
+ * label it carries.  Lines with the same text are matched in the order they were written, so a
+ * lost or filtered line doesn't shift the lines after it, and a line printed more often than it
+ * was written is a duplicate.
+ */
+void checkReplayLine(const char *line, size_t len, int64_t received, ReaderResult &result) {
+   const char *colon = (const char *)memchr(line, ':', len);
+   if (colon == nullptr || colon + 1 == line + len || colon[1] != ' ') {
+      return;
+   }
+   auto it = result.replayLabels.find(std::string(line, colon + 2 - line));
+   if (it == result.replayLabels.end()) {
+      return;
+   }
+   ReplayStream &stream = *it->second;
+   stream.printedLines++;
+   result.lines++;
+   size_t hash = line_hash(colon + 2, line + len - colon - 2);
+   auto range = std::equal_range(stream.index.begin(), stream.index.end(), std::make_pair(hash, (size_t)0),
+                                 [](const std::pair<size_t, size_t> &a, const std::pair<size_t, size_t> &b) { return a.first < b.first; });
+   size_t copy = stream.printedByHash[hash]++;
+   if (range.first == range.second) {
+      stream.unmatched++;
+      return;
+   } else if (copy >= (size_t)(range.second - range.first)) {
+      stream.duplicated++;
+      return;
+   }
+   size_t n = range.first[copy].second;
+   stream.printed[n] = true;
+   if (n < stream.written.load(std::memory_order_acquire)) {
+      result.latency.record(perf_nanos(received - stream.sent[n]));
+   }
+}
+
+/** counts a line printed by tailer and records its latency if it is one of the synthetic lines */
+void checkLine(const char *line, size_t len, int64_t received, ReaderResult &result) {
+   if (!result.replayLabels.empty()) {
+      checkReplayLine(line, len, received, result);
+      return;
+   }
+   std::string text(line, len);
+   size_t seqPos = text.find(" seq=");
+   size_t sentPos = text.find(" sent=");
+   if (seqPos == std::string::npos || sentPos == std::string::npos) {
+      return;
+   }
+   unsigned file = 0;
+   unsigned long long seq = 0;
+   long long sent = 0;
+   if (sscanf(text.c_str() + seqPos, " seq=%u:%llu", &file, &seq) != 2 || sscanf(text.c_str() + sentPos, " sent=%lld", &sent) != 1
+       || file >= result.seen.size()) {
+      return;
+   }
+   std::vector<unsigned char> &seen = result.seen[file];
+   if (seq >= seen.size()) {
+      seen.resize((size_t)seq + 1);
+   }
+   if (seen[(size_t)seq] < 255) {
+      seen[(size_t)seq]++;
+   }
+   result.lines++;
+   result.latency.record(perf_nanos(received - sent));
+}
+
+/** reads tailer's output from the pipe until it is closed */
+void readOutput(HANDLE pipe, ReaderResult &result) {
+   std::vector<char> buf(PIPE_READ_LEN);
+   std::string partial;
+   DWORD bytesRead = 0;
+   while (ReadFile(pipe, buf.data(), PIPE_READ_LEN, &bytesRead, NULL) && bytesRead > 0) {
+      int64_t received = perf_counter();
+      result.bytes += bytesRead;
+      const char *p = buf.data();
+      const char *end = p + bytesRead;
+      while (p < end) {
+         const char *eol = (const char *)memchr(p, '\n', end - p);
+         if (eol == nullptr) {
+            partial.append(p, end - p);
+            break;
+         }
+         if (partial.empty()) {
+            checkLine(p, eol - p, received, result);
+         } else {
+            partial.append(p, eol - p);
+            checkLine(partial.data(), partial.size(), received, result);
+            partial.clear();
+         }
+         p = eol + 1;
+      }
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// benchmark
+//
+
+/**
+ * Command-line argument parser
+ */
+class Args {
+private:
+   args::ArgumentParser parser;
+   args::HelpFlag help;
+   args::Positional<std::string> tailer;
+   args::ValueFlag<std::string> dir;
+   args::ValueFlag<int> files;
+   args::ValueFlag<int> rate;
+   args::ValueFlag<int> min_line;
+   args::ValueFlag<int> max_line;
+   args::Flag exponential;
+   args::ValueFlag<int> rotate_mb;
+   args::ValueFlag<int> seconds;
+   args::ValueFlag<std::string> tailer_args;
+   args::ValueFlag<std::string> output;
+   args::ValueFlag<std::string> replay;
+   args::ValueFlag<std::string> replay_pattern;
+   args::ValueFlag<double> speed;
+   args::ValueFlag<std::string> timestamp_format;
+   args::ValueFlag<std::string> beep_pattern;
+   int stat{0};
+
+public:
+   Args(int argc, char *argv[]) :
+         parser("Benchmark tailer with synthetic log writers or a replay of captured logs: measures the sustained throughput, CPU time, peak working set, lost and duplicated lines and write-to-print latency, and prints the results as JSON."),
+         help(parser, "help", "Display this help menu", {'h', "help"}),
+         tailer(parser, "tailer", "Path of the tailer executable to benchmark."),
+         dir(parser, "directory", "Directory the synthetic log files are written to (defaults to logbench.tmp).  Old bench*_*.log files in it are deleted.", {'d', "dir"}),
+         files(parser, "files", "Number of files written at the same time (defaults to 4).", {'f', "files"}),
+         rate(parser, "lines", "Lines written per second to each file (defaults to 1000).", {'r', "rate"}),
+         min_line(parser, "bytes", "Shortest line, or the mean line length with --exponential (defaults to 80).", {"min-line"}),
+         max_line(parser, "bytes", "Longest line (defaults to 200).", {"max-line"}),
+         exponential(parser, "exponential", "Draw the line lengths from an exponential distribution instead of a uniform one.", {"exponential"}),
+         rotate_mb(parser, "megabytes", "Continue in a new file once a file reaches this size (defaults to never).", {'k', "rotate"}),
+         seconds(parser, "seconds", "How long the writers run (defaults to 10, or until the end of the capture with --replay).", {'t', "time"}),
+         tailer_args(parser, "arguments", "Extra arguments for tailer, e.g. \"--overlapped --mmap\".  --noprefix only works with the synthetic lines, which carry their file and sequence number; replayed lines are matched to their prefix by tailer's 'prefix: ' label.", {'a', "args"}),
+         output(parser, "path", "Also write the JSON results to this file.", {'o', "output"}),
+         replay(parser, "directory", "Instead of synthetic lines, replay the logs captured in this directory at the pace of their timestamps.  Each prefix's files are written one after the other under their original names, so they rotate where the originals did, and the printed lines are matched to the written ones by their text.", {"replay"}),
+         replay_pattern(parser, "pattern", "Regex for the names of the captured files; the first capturing group is the prefix (defaults to tailer's '(ess.*|tfe.*)_\\d+\\.log').", {"replay-pattern"}),
+         speed(parser, "factor", "Replay speed relative to the captured timestamps, e.g. 10 for ten times as fast, or 0 for as fast as possible (defaults to 1).", {"speed"}),
+         timestamp_format(parser, "format", "Format of the timestamps in the captured lines, as for tailer's --timestamp (defaults to '%Y-%m-%d %H:%M:%S,%f').", {"timestamp"}),
+         beep_pattern(parser, "pattern", "Regex whose hit rate on the replayed lines is reported (defaults to tailer's beep pattern).", {"beep"})
+   {
+      try {
+         parser.ParseCLI(argc, argv);
+      } catch (args::Help) {
+         showHelp();
+      } catch (args::ParseError e) {
+         std::cerr << e.what() << std::endl;
+         std::cerr << parser;
+         stat = -1;
+      } catch (args::ValidationError e) {
+         std::cerr << e.what() << std::endl;
+         std::cerr << parser;
+         stat = -1;
+      }
+   }
+
+   int getStat() {  return stat;  }
+   bool getHelp() { return help ? true : false;  }
+   void showHelp() {  std::cout << parser; }
+   std::string getTailer() {  return tailer ? args::get(tailer) : ""; }
+   std::string getDir() {  return dir ? args::get(dir) : "logbench.tmp"; }
+   unsigned getFiles() {  return files ? (unsigned)std::max(1, args::get(files)) : 4; }
+   unsigned getRate() {  return rate ? (unsigned)std::max(1, args::get(rate)) : 1000; }
+   unsigned getMinLine() {  return min_line ? (unsigned)std::max(1, args::get(min_line)) : 80; }
+   unsigned getMaxLine() {  return max_line ? (unsigned)std::max(1, args::get(max_line)) : 200; }
+   bool getExponential() {  return exponential ? true : false; }
+   uint64_t getRotateBytes() {  return rotate_mb ? (uint64_t)std::max(0, args::get(rotate_mb)) * 1024 * 1024 : 0; }
+   unsigned getSeconds(unsigned defaultSeconds) {  return seconds ? (unsigned)std::max(1, args::get(seconds)) : defaultSeconds; }
+   std::string getTailerArgs() {  return tailer_args ? args::get(tailer_args) : ""; }
+   std::string getOutput() {  return output ? args::get(output) : ""; }
+   std::string getReplay() {  return replay ? args::get(replay) : ""; }
+   std::string getReplayPattern() {  return replay_pattern ? args::get(replay_pattern) : REPLAY_PATTERN; }
+   double getSpeed() {  return speed ? std::max(0.0, args::get(speed)) : 1.0; }
+   std::string getTimestampFormat() {  return timestamp_format ? args::get(timestamp_format) : "%Y-%m-%d %H:%M:%S,%f"; }
+   std::string getBeepPattern() {  return beep_pattern ? args::get(beep_pattern) : BEEP_PATTERN; }
+};
+
+/** starts tailer on the benchmark directory with its stdout redirected to 'pipe' */
+bool startTailer(const BenchOptions &opts, HANDLE pipe, PROCESS_INFORMATION &pi) {
+   std::wstringstream cmd;
+   cmd << L"\"" << opts.tailer.wstring() << L"\" \"" << opts.dir.wstring() << L"\" -n -m " << opts.files
+       << L" -p \"" << fs::path(opts.replayDir.empty() ? FILE_PATTERN : opts.replayPattern).wstring() << L"\" "
+       << fs::path(opts.tailerArgs).wstring();
+   std::wstring cmdLine = cmd.str();
+   STARTUPINFO si{};
+   si.cb = sizeof(si);
+   si.dwFlags = STARTF_USESTDHANDLES;
+   si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+   si.hStdOutput = pipe;
+   si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+   return CreateProcess(NULL, &cmdLine[0], NULL, NULL, TRUE, 0, NULL, NULL, &si, &pi) != FALSE;
+}
+
+/** replayed lines written but never printed */
+uint64_t countLost(const ReplayStream &stream) {
+   uint64_t lost = 0;
+   size_t written = stream.written.load();
+   for (size_t n = 0; n < written; n++) {
+      lost += !stream.printed[n];
+   }
+   return lost;
+}
+
+/** replayed lines written that match the beep pattern */
+uint64_t countBeeps(const ReplayStream &stream) {
+   size_t written = stream.written.load();
+   return std::count(stream.beeps.begin(), stream.beeps.begin() + written, true);
+}
+
+/** lines written but never printed and lines printed more than once */
+void countLost(const std::vector<WriterResult> &writers, const ReaderResult &reader, const std::vector<std::unique_ptr<ReplayStream>> &streams,
+               uint64_t &lost, uint64_t &duplicated) {
+   lost = 0;
+   duplicated = 0;
+   if (!streams.empty()) {
+      for (auto &stream : streams) {
+         lost += countLost(*stream);
+         duplicated += stream->duplicated;
+      }
+      return;
+   }
+   for (size_t file = 0; file < writers.size(); file++) {
+      const std::vector<unsigned char> &seen = reader.seen[file];
+      for (uint64_t seq = 0; seq < writers[file].lines; seq++) {
+         unsigned count = seq < seen.size() ? seen[(size_t)seq] : 0;
+         lost += count == 0;
+         duplicated += count > 1 ? count - 1 : 0;
+      }
+   }
+}
+
+/**
+ * Writes the results as JSON.  A replay also reports each prefix on its own and the hit rates of
+ * the file name pattern on the captured files and of the beep pattern on the replayed lines.
+ */
+void writeJson(std::ostream &out, const BenchOptions &opts, const std::vector<WriterResult> &writers, const ReaderResult &reader,
+               const std::vector<std::unique_ptr<ReplayStream>> &streams, size_t captureFiles,
+               uint64_t lost, uint64_t duplicated, double seconds, uint64_t cpuNanos, SIZE_T peakWorkingSet) {
+   uint64_t written = 0, bytes = 0;
+   unsigned rotations = 0;
+   for (auto &writer : writers) {
+      written += writer.lines;
+      bytes += writer.bytes;
+      rotations += writer.rotations;
+   }
+   out << std::fixed << std::setprecision(1);
+   if (opts.replayDir.empty()) {
+      out << "{\"files\":" << opts.files << ",\"rate_per_file\":" << opts.rate << ",\"min_line\":" << opts.minLineLen
+          << ",\"max_line\":" << opts.maxLineLen << ",\"distribution\":\"" << (opts.exponential ? "exponential" : "uniform")
+          << "\",\"rotate_bytes\":" << opts.rotateBytes;
+   } else {
+      size_t replayFiles = 0;
+      uint64_t beeps = 0;
+      for (auto &stream : streams) {
+         replayFiles += stream->files.size();
+         beeps += countBeeps(*stream);
+      }
+      out << "{\"replay\":" << json_string(opts.replayDir.generic_string()) << ",\"prefixes\":" << opts.files << ",\"speed\":" << opts.speed
+          << ",\"file_pattern\":" << json_string(opts.replayPattern) << ",\"capture_files\":" << captureFiles
+          << ",\"file_pattern_hits\":" << replayFiles << ",\"file_pattern_hit_rate\":" << std::setprecision(4)
+          << (captureFiles > 0 ? (double)replayFiles / captureFiles : 0.0)
+          << ",\"beep_pattern\":" << json_string(opts.beepPattern) << ",\"beep_hits\":" << beeps
+          << ",\"beep_hit_rate\":" << (written > 0 ? (double)beeps / written : 0.0) << std::setprecision(1) << ",\"streams\":[";
+      for (size_t i = 0; i < streams.size(); i++) {
+         const ReplayStream &stream = *streams[i];
+         size_t streamWritten = stream.written.load();
+         uint64_t streamBeeps = countBeeps(stream);
+         out << (i > 0 ? "," : "") << "{\"prefix\":" << json_string(stream.prefix) << ",\"files\":" << stream.files.size()
+             << ",\"lines_written\":" << streamWritten << ",\"lines_printed\":" << stream.printedLines
+             << ",\"lines_lost\":" << countLost(stream) << ",\"lines_duplicated\":" << stream.duplicated
+             << ",\"lines_unmatched\":" << stream.unmatched << ",\"beep_hits\":" << streamBeeps
+             << ",\"beep_hit_rate\":" << std::setprecision(4) << (streamWritten > 0 ? (double)streamBeeps / streamWritten : 0.0)
+             << std::setprecision(1) << "}";
+      }
+      out << "]";
+   }
+   out << ",\"seconds\":" << seconds
+       << ",\"lines_written\":" << written << ",\"bytes_written\":" << bytes << ",\"rotations\":" << rotations
+       << ",\"lines_printed\":" << reader.lines << ",\"lines_lost\":" << lost << ",\"lines_duplicated\":" << duplicated
+       << ",\"lines_per_sec\":" << reader.lines / seconds << ",\"output_bytes_per_sec\":" << reader.bytes / seconds
+       << ",\"tailer_cpu_ms\":" << cpuNanos / 1e6 << ",\"tailer_cpu_percent\":" << cpuNanos / 1e7 / seconds
+       << ",\"tailer_peak_working_set_kb\":" << peakWorkingSet / 1024
+       << ",\"latency_ms\":{\"p50\":" << reader.latency.percentile(50) / 1e6 << ",\"p99\":" << reader.latency.percentile(99) / 1e6
+       << ",\"p99_9\":" << reader.latency.percentile(99.9) / 1e6 << ",\"max\":" << reader.latency.getMax() / 1e6 << "}}" << std::endl;
+}
+
+int runBenchmark(BenchOptions &opts, const std::string &outputPath) {
+   std::error_code ec;
+   std::vector<std::unique_ptr<ReplayStream>> streams;
+   size_t captureFiles = 0;
+   int64_t firstTimestamp = INT64_MAX;
+   if (!opts.replayDir.empty()) {
+      if (fs::equivalent(opts.replayDir, opts.dir, ec)) {
+         std::cerr << "The replay directory must not be the benchmark directory." << std::endl;
+         return 1;
+      }
+      try {
+         firstTimestamp = loadCapture(opts, streams, captureFiles);
+      } catch (std::exception &e) {
+         std::cerr << "Unable to read " << opts.replayDir << ": " << e.what() << std::endl;
+         return 2;
+      }
+      if (streams.empty()) {
+         std::cerr << "No files in " << opts.replayDir << " match " << opts.replayPattern << std::endl;
+         return 1;
+      } else if (firstTimestamp == INT64_MAX && opts.speed > 0) {
+         std::cerr << "No line starts with a timestamp in the format " << opts.timestampFormat << ", replaying as fast as possible." << std::endl;
+         opts.speed = 0;
+      }
+      opts.files = (unsigned)streams.size();
+   }
+
+   fs::create_directories(opts.dir, ec);
+   std::regex benchFile("bench\\d+_\\d+\\.log");
+   for (auto &entry : fs::directory_iterator(opts.dir)) {
+      if (std::regex_match(entry.path().filename().string(), benchFile)) {
+         fs::remove(entry.path(), ec);
+      }
+   }
+   for (auto &stream : streams) {
+      for (auto &file : stream->files) {
+         fs::remove(opts.dir / file.filename(), ec);
+      }
+   }
+   // create the files first so tailer finds them on its initial scan
+   for (unsigned file = 0; file < opts.files; file++) {
+      create_log_file(streams.empty() ? file_path(opts.dir, file, 0) : opts.dir / streams[file]->files.front().filename());
+   }
+
+   SECURITY_ATTRIBUTES sa{sizeof(SECURITY_ATTRIBUTES), NULL, TRUE};
+   HANDLE readPipe = NULL;
+   HANDLE writePipe = NULL;
+   if (!CreatePipe(&readPipe, &writePipe, &sa, PIPE_READ_LEN)) {
+      std::cerr << "Unable to create pipe: " << get_last_error() << std::endl;
+      return 2;
+   }
+   unique_handle<GenericHandlePolicy> readEnd(readPipe);
+   unique_handle<GenericHandlePolicy> writeEnd(writePipe);
+   SetHandleInformation(readPipe, HANDLE_FLAG_INHERIT, 0);
+   PROCESS_INFORMATION pi{};
+   if (!startTailer(opts, writePipe, pi)) {
+      std::cerr << "Unable to start " << opts.tailer << ": " << get_last_error() << std::endl;
+      return 2;
+   }
+   unique_handle<GenericHandlePolicy> process(pi.hProcess);
+   unique_handle<GenericHandlePolicy> thread(pi.hThread);
+   writeEnd.reset();   // the pipe is closed when tailer exits
+
+   ReaderResult reader;
+   reader.seen.resize(opts.files);
+   for (auto &stream : streams) {
+      reader.replayLabels.emplace(stream->prefix + ": ", stream.get());
+   }
+   std::thread readerThread(readOutput, readPipe, std::ref(reader));
+   Sleep(STARTUP_MILLIS);
+
+   std::atomic<bool> stop{false};
+   std::atomic<unsigned> finished{0};
+   std::vector<WriterResult> writers(opts.files);
+   std::vector<std::thread> writerThreads;
+   int64_t start = perf_counter();
+   for (unsigned file = 0; file < opts.files; file++) {
+      if (streams.empty()) {
+         writerThreads.emplace_back(writeLines, std::cref(opts), file, std::ref(stop), std::ref(writers[file]));
+      } else {
+         writerThreads.emplace_back([&, file] {
+            replayLines(opts, *streams[file], firstTimestamp, start, stop, writers[file]);
+            finished++;
+         });
+      }
+   }
+   ULONGLONG runStart = GetTickCount64();
+   while (finished.load() < opts.files && (opts.seconds == 0 || GetTickCount64() - runStart < opts.seconds * 1000ull)) {
+      Sleep(100);
+   }
+   stop.store(true);
+   for (auto &t : writerThreads) {
+      t.join();
+   }
+   uint64_t written = 0;
+   for (auto &w : writers) {
+      written += w.lines;
+   }
+   // give tailer time to catch up
+   ULONGLONG drainStart = GetTickCount64();
+   while (reader.lines < written && GetTickCount64() - drainStart < DRAIN_MILLIS) {
+      Sleep(100);
+   }
+   double seconds = perf_nanos(perf_counter() - start) / 1e9;
+
+   FILETIME created, exited, kernel, user;
+   uint64_t cpuNanos = 0;
+   if (GetProcessTimes(process.get(), &created, &exited, &kernel, &user)) {
+      cpuNanos = ((((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime)
+                + (((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime)) * 100;
+   }
+   PROCESS_MEMORY_COUNTERS memory{};
+   GetProcessMemoryInfo(process.get(), &memory, sizeof(memory));
+   TerminateProcess(process.get(), 0);
+   readerThread.join();
+
+   for (size_t file = 0; file < writers.size(); file++) {
+      if (writers[file].failed) {
+         std::cerr << "Writing " << (streams.empty() ? "bench" + std::to_string(file) : streams[file]->prefix) << " failed: " << get_last_error() << std::endl;
+      }
+   }
+   uint64_t lost, duplicated;
+   countLost(writers, reader, streams, lost, duplicated);
+   writeJson(std::cout, opts, writers, reader, streams, captureFiles, lost, duplicated, seconds, cpuNanos, memory.PeakWorkingSetSize);
+   if (!outputPath.empty()) {
+      std::ofstream out(outputPath);
+      writeJson(out, opts, writers, reader, streams, captureFiles, lost, duplicated, seconds, cpuNanos, memory.PeakWorkingSetSize);
+   }
+   return 0;
+}
+
+int main(int argc, char *argv[]) {
+   Args args(argc, argv);
+   if (args.getStat() != 0) {
+      return args.getStat();
+   } else if (args.getHelp()) {
+      return 0;
+   } else if (args.getTailer().empty()) {
+      args.showHelp();
+      return 1;
+   }
+   BenchOptions opts;
+   opts.tailer = fs::path(args.getTailer());
+   opts.tailerArgs = args.getTailerArgs();
+   opts.dir = fs::absolute(fs::path(args.getDir()));
+   opts.files = args.getFiles();
+   opts.rate = args.getRate();
+   opts.minLineLen = args.getMinLine();
+   opts.maxLineLen = std::max(args.getMinLine(), args.getMaxLine());
+   opts.exponential = args.getExponential();
+   opts.rotateBytes = args.getRotateBytes();
+   opts.replayDir = args.getReplay().empty() ? fs::path() : fs::absolute(fs::path(args.getReplay()));
+   opts.replayPattern = args.getReplayPattern();
+   opts.timestampFormat = args.getTimestampFormat();
+   opts.beepPattern = args.getBeepPattern();
+   opts.speed = args.getSpeed();
+   opts.seconds = args.getSeconds(opts.replayDir.empty() ? 10 : 0);
+   try {
+      std::regex checkPattern(opts.replayPattern);
+      std::regex checkBeep(opts.beepPattern);
+      TimestampFormat checkFormat(opts.timestampFormat);
+   } catch (std::exception &e) {
+      std::cerr << "Invalid argument: " << e.what() << std::endl;
+      return 1;
+   }
+   if (!opts.replayDir.empty() && opts.tailerArgs.find("--noprefix") != std::string::npos) {
+      std::cerr << "--noprefix can't be used with --replay: the replayed lines are matched to their prefix by tailer's 'prefix: ' label." << std::endl;
+      return 1;
+   }
+   return runBenchmark(opts, args.getOutput());
+}
@@ -0,0 +1,792 @@
+// microbench.cpp : Microbenchmarks of tailer's hot-path stages.  Every stage runs on the same
+// generated inputs (fixed seed) with the implementation tailer started with and with tailer's own
+// engines, which are compiled in from tailer.cpp, so a change to one stage can be measured
+// against the same baseline.
+//
+
+#define TAILER_NO_MAIN
+#include "../tailer/tailer.cpp"
+#include <functional>
+#include <iterator>
+#include <map>
+#include <random>
+#include <sstream>
+#include <psapi.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// constants
+//
+
+/** tailer's default file name and beep patterns */
+const char FILE_PATTERN[]{ "(ess.*|tfe.*)_\\d+\\.log" };
+const char BEEP_PATTERN[]{ ".*[a-zA-Z]+\\.[a-zA-Z]+(Exception|Error):" };
+
+/** --filter expression of the filter benchmark, and the regex grep would need to select the same lines */
+const char FILTER_EXPRESSION[]{ "level>=WARN and msg~Exception" };
+const char FILTER_REGEX[]{ "^\\S+ \\S+ (WARN|ERROR|FATAL) +\\[[^\\]]*\\] - .*Exception" };
+
+/** --search pattern of the search benchmark */
+const char SEARCH_PATTERN[]{ "lang\\.[a-z]+Error:" };
+
+/** appended ranges the read engines are timed on: below, at and past MMAP_THRESHOLD and CATCHUP_THRESHOLD, up to a whole view */
+const int64_t READ_DELTAS[]{ 64 * 1024, 1024 * 1024, MMAP_THRESHOLD, CATCHUP_THRESHOLD, MAP_VIEW_LEN };
+
+/** size of the unbuffered writes that create the files of the catch-up measurement, a multiple of the sector size */
+const DWORD CATCHUP_WRITE_LEN{ 4 * 1024 * 1024 };
+
+/** fraction of the generated lines that report an exception */
+const double EXCEPTION_FRACTION{ 0.01 };
+
+/** fraction of the prefixes that disappear or appear between two scans in the diff benchmark */
+const double CHURN_FRACTION{ 0.05 };
+
+///////////////////////////////////////////////////////////////////////////////
+// types
+//
+
+/** what one run of a benchmark processed; 'checksum' must agree between engines of a stage */
+struct BenchResult {
+   uint64_t items;
+   uint64_t bytes;
+   uint64_t checksum;
+   int64_t copied{-1};                       // bytes copied on their way to the output, -1 if not counted
+};
+
+struct Benchmark {
+   std::string stage;
+   const char *engine;
+   std::function<BenchResult()> run;
+};
+
+/** generated inputs shared by the benchmarks */
+struct Inputs {
+   std::string block;                        // log lines separated by \r\n
+   std::vector<std::string_view> lines;      // the lines of 'block' without the line ends
+   std::vector<std::string> fileNames;       // mix of names that do and don't match FILE_PATTERN
+   fs::path dir;                             // scratch directory holding the files below
+   fs::path scanDir;                         // one empty file per name
+   fs::path watchDir;                        // one file with a line in it per prefix, polled by the pass benchmark
+   fs::path readPath;                        // the block repeated up to the largest of READ_DELTAS
+   std::vector<int64_t> readSizes;           // end of the last whole line within each of READ_DELTAS
+   std::vector<uint64_t> readLines;          // lines up to each of 'readSizes'
+   std::unordered_map<std::string, std::shared_ptr<std::string>> oldMap;   // prefix -> file before and after a scan
+   std::unordered_map<std::string, std::shared_ptr<std::string>> newMap;
+};
+
+/** the read engines timed by the read benchmarks, see readRange() */
+enum class ReadEngine { ReadFile, Overlapped, NoCache, Mapped, PassThrough };
+
+/** the file of the read benchmarks, open for each of the read engines */
+struct ReadTarget {
+   LogFileInfo info;                         // opened for synchronous reads
+   LogFileInfo overlappedInfo;               // opened for and attached to 'reader'
+   OverlappedReader reader;
+
+   ReadTarget(const fs::path &path, FileSystem &fileSystem, Clock &clock) :
+         info{"read", path, fileSystem, clock}, overlappedInfo{"read", path, fileSystem, clock} {
+      info.openHandle(false);
+      if (overlappedInfo.openHandle(true) && !reader.attach(overlappedInfo)) {
+         overlappedInfo.closeHandle();
+      }
+   }
+};
+
+/** discards what tailer prints about the files it watches */
+class NullBuffer : public std::streambuf {
+protected:
+   int overflow(int ch) override { return ch; }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// globals
+//
+
+/** the clock and file system tailer's engines run against */
+SystemClock systemClock;
+SystemFileSystem systemFileSystem;
+
+///////////////////////////////////////////////////////////////////////////////
+// inputs
+//
+
+std::string random_word(std::mt19937 &random, unsigned minLen, unsigned maxLen) {
+   static const char letters[] = "abcdefghijklmnopqrstuvwxyz";
+   unsigned len = std::uniform_int_distribution<unsigned>(minLen, maxLen)(random);
+   std::string word;
+   for (unsigned i = 0; i < len; i++) {
+      word += letters[random() % 26];
+   }
+   return word;
+}
+
+/** log lines like tailer's sample output; about one in a hundred reports an exception */
+void generateLines(std::mt19937 &random, unsigned count, Inputs &in) {
+   static const char *const levels[] = { "DEBUG", "INFO", "INFO", "INFO", "WARN", "ERROR" };
+   static const char *const threads[] = { "main", "ModalContext", "Exec Stream Pumper", "pool-2-thread-1" };
+   std::bernoulli_distribution exception(EXCEPTION_FRACTION);
+   char timestamp[32];
+   for (unsigned i = 0; i < count; i++) {
+      snprintf(timestamp, sizeof(timestamp), "2022-02-16 18:%02u:%02u,%03u", (i / 60000) % 60, (i / 1000) % 60, i % 1000);
+      in.block += timestamp;
+      in.block += ' ';
+      in.block += levels[random() % 6];
+      in.block += " [";
+      in.block += threads[random() % 4];
+      in.block += "] - ";
+      if (exception(random)) {
+         in.block += "java.lang." + random_word(random, 4, 12) + (random() % 2 ? "Exception: " : "Error: ");
+      }
+      unsigned words = std::uniform_int_distribution<unsigned>(3, 25)(random);
+      for (unsigned w = 0; w < words; w++) {
+         in.block += (w > 0 ? " " : "") + random_word(random, 1, 10);
+      }
+      in.block += "\r\n";
+   }
+   for (size_t start = 0; start < in.block.size();) {
+      size_t eol = in.block.find('\n', start);
+      in.lines.emplace_back(in.block.data() + start, eol - start - 1);
+      start = eol + 1;
+   }
+}
+
+/** file names for the regex and scan benchmarks: three in four match FILE_PATTERN */
+void generateFileNames(std::mt19937 &random, unsigned count, Inputs &in) {
+   for (unsigned i = 0; i < count; i++) {
+      std::string prefix = (random() % 2 ? "tfe" : "ess") + random_word(random, 0, 8);
+      std::string stamp = std::to_string(1645051728320ull + random() % 100000000);
+      switch (random() % 4) {
+      case 0: in.fileNames.push_back(prefix + "_" + stamp + ".txt"); break;
+      default: in.fileNames.push_back(prefix + "_" + stamp + ".log"); break;
+      }
+   }
+}
+
+/** the scanned directory, 'watched' logs of their own prefix to poll and the file of the read benchmarks */
+void createFiles(unsigned watched, Inputs &in) {
+   std::error_code ec;
+   fs::remove_all(in.dir, ec);
+   in.scanDir = in.dir / "scan";
+   in.watchDir = in.dir / "watch";
+   in.readPath = in.dir / "read.log";
+   fs::create_directories(in.scanDir);
+   fs::create_directories(in.watchDir);
+   for (auto &name : in.fileNames) {
+      std::ofstream(in.scanDir / name);
+   }
+   for (unsigned i = 0; i < watched; i++) {
+      std::ofstream(in.watchDir / ("tfe" + std::to_string(i) + "_1.log"), std::ios::binary) << in.lines[i % in.lines.size()] << "\r\n";
+   }
+
+   std::string data;
+   while ((int64_t)data.size() < *std::max_element(std::begin(READ_DELTAS), std::end(READ_DELTAS))) {
+      data += in.block;
+   }
+   for (int64_t delta : READ_DELTAS) {
+      int64_t size = (int64_t)data.rfind('\n', (size_t)delta - 1) + 1;
+      in.readSizes.push_back(size);
+      in.readLines.push_back((uint64_t)std::count(data.begin(), data.begin() + size, '\n'));
+   }
+   std::ofstream(in.readPath, std::ios::binary).write(data.data(), in.readSizes.back());
+}
+
+/** the prefix map before and after a scan: a few prefixes disappear, appear or rotate */
+void generateMaps(std::mt19937 &random, unsigned count, Inputs &in) {
+   std::bernoulli_distribution churn(CHURN_FRACTION);
+   for (unsigned i = 0; i < count; i++) {
+      std::string prefix = "tfe" + std::to_string(i);
+      auto file = std::make_shared<std::string>(prefix + "_1.log");
+      if (!churn(random)) {
+         in.oldMap.emplace(prefix, file);
+         in.newMap.emplace(prefix, churn(random) ? std::make_shared<std::string>(prefix + "_2.log") : file);
+      } else if (random() % 2) {
+         in.oldMap.emplace(prefix, file);
+      } else {
+         in.newMap.emplace(prefix, file);
+      }
+   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// benchmarks
+//
+
+/** "64K", "1M" and the like */
+std::string size_label(int64_t bytes) {
+   return bytes % (1024 * 1024) == 0 ? std::to_string(bytes / (1024 * 1024)) + "M" : std::to_string(bytes / 1024) + "K";
+}
+
+/**
+ * Reads the first 'size' bytes of the file with one of tailer's read engines, as a pass that
+ * finds them appended would, and prints the lines without a prefix so that every engine prints
+ * the same bytes.  Counts the bytes copied out of the file cache before they reach the output:
+ * into the read buffer unless they are split from a mapped view, and into the output batch
+ * unless they are written straight from the view.
+ */
+BenchResult readRange(ReadTarget &target, int64_t size, uint64_t lines, ReadEngine engine) {
+   LogFileInfo &info = engine == ReadEngine::Overlapped ? target.overlappedInfo : target.info;
+   TailContext ctx;
+   ctx.pclock = &systemClock;
+   ctx.pfs = &systemFileSystem;
+   ctx.showPrefix = false;
+   info.setLastTailedPosition(0);
+   switch (engine) {
+   case ReadEngine::ReadFile:
+      readAppendedData(info, size, ctx);
+      break;
+   case ReadEngine::Overlapped:
+      if (info.isOpen()) {
+         ctx.preader = &target.reader;
+         ctx.preader->startRead(info, size);
+         ctx.preader->completeReads(ctx);
+      }
+      break;
+   case ReadEngine::NoCache:
+      readUncached(info, size, ctx);
+      break;
+   case ReadEngine::Mapped:
+      readMapped(info, size, ctx);
+      break;
+   case ReadEngine::PassThrough:
+      passThrough(info, size, ctx);
+      break;
+   }
+   ctx.sink.flush();
+   uint64_t written = ctx.sink.getBytesWritten();
+   bool mapped = engine == ReadEngine::Mapped || engine == ReadEngine::PassThrough;
+   int64_t copied = (mapped ? 0 : ctx.stats.bytesRead) + (engine == ReadEngine::PassThrough ? 0 : written);
+   return BenchResult{lines, (uint64_t)size, written, copied};
+}
+
+std::vector<Benchmark> createBenchmarks(const Inputs &in) {
+   std::vector<Benchmark> benchmarks;
+   const uint64_t blockLen = in.block.size();
+
+   // line splitting; splitLines also labels the lines and batches them for the (null) stdout
+   benchmarks.push_back({"split", "getline", [&in, blockLen] {
+      std::istringstream stream(in.block);
+      std::string line;
+      uint64_t lines = 0, chars = 0;
+      while (std::getline(stream, line)) {
+         lines++;
+         chars += line.size();
+      }
+      return BenchResult{lines, blockLen, lines + chars};
+   }});
+   benchmarks.push_back({"split", "splitLines", [&in, blockLen] {
+      LogFileInfo info;
+      TailContext ctx;
+      ctx.pclock = &systemClock;
+      ctx.showPrefix = false;
+      splitLines(info, in.block.data(), in.block.size(), ctx);
+      ctx.sink.flush();
+      // each line is written with \r\n: as many bytes as getline counts, the line with its \r and one per line
+      return BenchResult{ctx.stats.linesRead, blockLen, ctx.sink.getBytesWritten()};
+   }});
+
+   // timestamps and whole lines parsed with std::get_time and std::regex, against the compiled
+   // TimestampFormat and LineLayout of LogLayout.h
+   auto parseTime = [](const char *p, size_t len, int64_t &millis) {
+      std::tm tm{};
+      char comma = 0;
+      unsigned ms = 0;
+      std::istringstream stream(std::string(p, std::min<size_t>(len, 23)));
+      stream >> std::get_time(&tm, "%Y-%m-%d %H:%M:%S") >> comma >> ms;
+      if (stream.fail() || comma != ',') {
+         return false;
+      }
+      millis = (days_from_civil(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday) * 86400 + tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec) * 1000 + ms;
+      return true;
+   };
+   auto timestampFormat = std::make_shared<TimestampFormat>();
+   auto lineLayout = std::make_shared<LineLayout>();
+   auto lineRegex = std::make_shared<std::regex>("^(\\d{4}-\\d\\d-\\d\\d \\d\\d:\\d\\d:\\d\\d,\\d{3}) +(\\w+) +\\[([^\\]]*)\\] - (.*)$");
+   benchmarks.push_back({"timestamp", "std::get_time", [&in, blockLen, parseTime] {
+      uint64_t sum = 0;
+      int64_t millis;
+      for (auto line : in.lines) {
+         sum += parseTime(line.data(), line.size(), millis) ? millis : 0;
+      }
+      return BenchResult{in.lines.size(), blockLen, sum};
+   }});
+   benchmarks.push_back({"timestamp", "TimestampFormat", [&in, blockLen, timestampFormat] {
+      uint64_t sum = 0;
+      int64_t millis;
+      for (auto line : in.lines) {
+         sum += timestampFormat->parse(line.data(), line.size(), millis) ? millis : 0;
+      }
+      return BenchResult{in.lines.size(), blockLen, sum};
+   }});
+   benchmarks.push_back({"layout", "regex + get_time", [&in, blockLen, parseTime, lineRegex] {
+      std::cmatch match;
+      uint64_t sum = 0;
+      int64_t millis;
+      for (auto line : in.lines) {
+         if (std::regex_search(line.data(), line.data() + line.size(), match, *lineRegex) && parseTime(match[1].first, match[1].length(), millis)) {
+            sum += millis + (uint64_t)parse_level(match[2].first, match[2].length()) + match[3].length() + match[4].length();
+         }
+      }
+      return BenchResult{in.lines.size(), blockLen, sum};
+   }});
+   benchmarks.push_back({"layout", "LineLayout", [&in, blockLen, lineLayout] {
+      LineFields fields;
+      uint64_t sum = 0;
+      for (auto line : in.lines) {
+         if (lineLayout->parse(line.data(), line.size(), fields)) {
+            sum += fields.millis + (uint64_t)fields.level + fields.thread.size() + fields.message.size();
+         }
+      }
+      return BenchResult{in.lines.size(), blockLen, sum};
+   }});
+
+   // beep pattern, searched for in every line
+   auto beepRegex = std::make_shared<std::regex>(BEEP_PATTERN);
+   auto beepOptimized = std::make_shared<std::regex>(BEEP_PATTERN, std::regex::ECMAScript | std::regex::optimize | std::regex::nosubs);
+   auto countBeeps = [&in, blockLen](const std::function<bool(std::string_view)> &matches) {
+      uint64_t count = 0;
+      for (auto line : in.lines) {
+         count += matches(line);
+      }
+      return BenchResult{in.lines.size(), blockLen, count};
+   };
+   benchmarks.push_back({"beep", "regex", [countBeeps, beepRegex] {
+      return countBeeps([&](std::string_view line) { return std::regex_search(line.begin(), line.end(), *beepRegex); });
+   }});
+   benchmarks.push_back({"beep", "regex optimize", [countBeeps, beepOptimized] {
+      return countBeeps([&](std::string_view line) { return std::regex_search(line.begin(), line.end(), *beepOptimized); });
+   }});
+   // the default pattern can only match a line that contains "Exception:" or "Error:"
+   benchmarks.push_back({"beep", "literal prefilter", [countBeeps, beepOptimized] {
+      return countBeeps([&](std::string_view line) {
+         return (line.find("Exception:") != std::string_view::npos || line.find("Error:") != std::string_view::npos)
+                && std::regex_search(line.begin(), line.end(), *beepOptimized);
+      });
+   }});
+
+   // line selection: a grep-like regex over the whole line against tailer's --filter, which
+   // splits the line with the layout and looks for the literal in the message
+   auto filterRegex = std::make_shared<std::regex>(FILTER_REGEX);
+   auto filter = std::make_shared<LineFilter>(FILTER_EXPRESSION, std::vector<std::string>(), std::vector<std::string>());
+   benchmarks.push_back({"filter", "regex", [countBeeps, filterRegex] {
+      return countBeeps([&](std::string_view line) { return std::regex_search(line.begin(), line.end(), *filterRegex); });
+   }});
+   benchmarks.push_back({"filter", "selectLine", [countBeeps, filter, lineLayout] {
+      static const std::string noLabel;
+      LogFileInfo info;
+      TailContext ctx;
+      ctx.playout = lineLayout.get();
+      ctx.pfilter = filter.get();
+      return countBeeps([&](std::string_view line) { return selectLine(info, line.data(), line.size(), noLabel, ctx); });
+   }});
+
+   // --search: a regex on every line against SearchPattern, which looks for the literal in the
+   // block and only checks the lines it is found in
+   auto searchRegex = std::make_shared<std::regex>(SEARCH_PATTERN);
+   auto searchPattern = std::make_shared<SearchPattern>(SEARCH_PATTERN);
+   benchmarks.push_back({"search", "regex", [countBeeps, searchRegex] {
+      return countBeeps([&](std::string_view line) { return std::regex_search(line.begin(), line.end(), *searchRegex); });
+   }});
+   benchmarks.push_back({"search", "SearchPattern", [&in, blockLen, searchPattern] {
+      const char *p = in.block.data();
+      const char *end = p + in.block.size();
+      const char *line;
+      size_t len;
+      uint64_t count = 0;
+      while (searchPattern->find(p, end, line, len, p)) {
+         count++;
+      }
+      return BenchResult{in.lines.size(), blockLen, count};
+   }});
+
+   // file name pattern
+   auto fileRegex = std::make_shared<std::regex>(FILE_PATTERN);
+   auto fileOptimized = std::make_shared<std::regex>(FILE_PATTERN, std::regex::ECMAScript | std::regex::optimize);
+   auto countNames = [&in](const std::regex &rx) {
+      std::smatch match;
+      uint64_t count = 0;
+      for (auto &name : in.fileNames) {
+         if (std::regex_search(name, match, rx)) {
+            count += match[1].length();
+         }
+      }
+      return BenchResult{in.fileNames.size(), 0, count};
+   };
+   benchmarks.push_back({"filename", "regex", [countNames, fileRegex] { return countNames(*fileRegex); }});
+   benchmarks.push_back({"filename", "regex optimize", [countNames, fileOptimized] { return countNames(*fileOptimized); }});
+
+   // directory scan for the newest file of each prefix, as tailer started with and with collectLogFiles
+   auto newestByIterator = [&in, fileRegex](bool entryStatus) {
+      std::smatch match;
+      std::unordered_map<std::string, fs::path> newest;
+      uint64_t entries = 0;
+      for (const auto &entry : fs::directory_iterator(in.scanDir)) {
+         const fs::path path = entry.path();
+         entries++;
+         if (entryStatus ? !fs::is_directory(entry.status()) : fs::exists(path) && !fs::is_directory(path)) {
+            std::string str = path.filename().string();
+            if (std::regex_search(str, match, *fileRegex)) {
+               auto it = newest.find(match[1]);
+               if (it == newest.end()) {
+                  newest.emplace(match[1], path);
+               } else if (fs::last_write_time(path) > fs::last_write_time(it->second)) {
+                  it->second = path;
+               }
+            }
+         }
+      }
+      return BenchResult{entries, 0, newest.size()};
+   };
+   benchmarks.push_back({"scan", "directory_iterator", [newestByIterator] { return newestByIterator(false); }});
+   benchmarks.push_back({"scan", "directory_iterator status", [newestByIterator] { return newestByIterator(true); }});
+   benchmarks.push_back({"scan", "collectLogFiles", [&in, fileRegex] {
+      fs::path dir = in.scanDir;
+      size_t listed = 0;
+      std::shared_ptr<PrefixLogFileInfoMap> pmap = collectLogFiles(dir, *fileRegex, systemFileSystem, systemClock, &listed);
+      return BenchResult{listed, 0, pmap->size()};
+   }});
+
+   // polling pass over the watched files with nothing appended: the status of every file looked
+   // up by name against tailAllFiles, which queries the handles it keeps open
+   fs::path watchDir = in.watchDir;
+   std::shared_ptr<PrefixLogFileInfoMap> watched = collectLogFiles(watchDir, *fileRegex, systemFileSystem, systemClock);
+   benchmarks.push_back({"pass", "status by name", [watched] {
+      uint64_t found = 0;
+      for (auto &entry : *watched) {
+         FileStatus status;
+         found += systemFileSystem.getStatus(entry.second->getPath(), status);
+      }
+      return BenchResult{watched->size(), 0, found};
+   }});
+   benchmarks.push_back({"pass", "tailAllFiles", [watched] {
+      TailContext ctx;
+      ctx.pclock = &systemClock;
+      ctx.pfs = &systemFileSystem;
+      tailAllFiles(watched, ctx);
+      uint64_t open = 0;
+      for (auto &entry : *watched) {
+         open += entry.second->isOpen();
+      }
+      return BenchResult{watched->size(), 0, open};
+   }});
+
+   // prefix map diff, as in updateLogFilesMap (which also prints and rewires the watched files,
+   // so only its key comparison is timed)
+   uint64_t prefixes = in.oldMap.size() + in.newMap.size();
+   benchmarks.push_back({"diff", "std::set", [&in, prefixes] {
+      std::set<std::string> oldKeys;
+      std::set<std::string> newKeys;
+      std::set<std::string> removed;
+      std::transform(in.oldMap.begin(), in.oldMap.end(), std::inserter(oldKeys, oldKeys.end()), [](auto pair) { return pair.first; });
+      std::transform(in.newMap.begin(), in.newMap.end(), std::inserter(newKeys, newKeys.end()), [](auto pair) { return pair.first; });
+      std::set_difference(oldKeys.begin(), oldKeys.end(), newKeys.begin(), newKeys.end(), std::inserter(removed, removed.end()));
+      uint64_t added = 0, rotated = 0;
+      for (auto newEntry : in.newMap) {
+         auto oldEntryIt = in.oldMap.find(newEntry.first);
+         if (oldEntryIt == in.oldMap.end()) {
+            added++;
+         } else if (oldEntryIt->second != newEntry.second) {
+            rotated++;
+         }
+      }
+      return BenchResult{prefixes, 0, removed.size() * 1000000 + added * 1000 + rotated};
+   }});
+   benchmarks.push_back({"diff", "hash lookup", [&in, prefixes] {
+      uint64_t removed = 0, added = 0, rotated = 0;
+      for (auto &oldEntry : in.oldMap) {
+         removed += in.newMap.find(oldEntry.first) == in.newMap.end();
+      }
+      for (auto &newEntry : in.newMap) {
+         auto oldEntryIt = in.oldMap.find(newEntry.first);
+         if (oldEntryIt == in.oldMap.end()) {
+            added++;
+         } else if (oldEntryIt->second != newEntry.second) {
+            rotated++;
+         }
+      }
+      return BenchResult{prefixes, 0, removed * 1000000 + added * 1000 + rotated};
+   }});
+
+   // output formatting, written to the null device so the console isn't measured
+   static const std::string label{ "tfeLauncher: " };
+   benchmarks.push_back({"format", "ostream endl", [&in, blockLen] {
+      std::ofstream out("NUL", std::ios::binary);
+      uint64_t bytes = 0;
+      for (auto line : in.lines) {
+         out << label << std::string(line) << "\r" << std::endl;
+         bytes += label.size() + line.size() + 2;
+      }
+      return BenchResult{in.lines.size(), blockLen, bytes};
+   }});
+   benchmarks.push_back({"format", "OutputSink", [&in, blockLen] {
+      OutputSink sink;
+      for (auto line : in.lines) {
+         sink.writeLine(label, line.data(), line.size());
+      }
+      sink.flush();
+      return BenchResult{in.lines.size(), blockLen, sink.getBytesWritten()};
+   }});
+
+   // the read engines on appended ranges of several sizes, each read from the start of the file
+   static const std::pair<ReadEngine, const char *> engines[] = {
+      {ReadEngine::ReadFile, "ReadFile"}, {ReadEngine::Overlapped, "overlapped"}, {ReadEngine::NoCache, "nocache"},
+      {ReadEngine::Mapped, "mmap"}, {ReadEngine::PassThrough, "passthrough"}
+   };
+   auto target = std::make_shared<ReadTarget>(in.readPath, systemFileSystem, systemClock);
+   for (size_t i = 0; i < in.readSizes.size(); i++) {
+      int64_t size = in.readSizes[i];
+      uint64_t lines = in.readLines[i];
+      for (auto &engine : engines) {
+         ReadEngine which = engine.first;
+         benchmarks.push_back({"read " + size_label(READ_DELTAS[i]), engine.second, [target, size, lines, which] {
+            return readRange(*target, size, lines, which);
+         }});
+      }
+   }
+   return benchmarks;
+}
+
+/** size of the system file cache (its working set and the standby list) in bytes, -1 if unknown */
+int64_t system_cache_bytes() {
+   PERFORMANCE_INFORMATION perf{};
+   perf.cb = sizeof(perf);
+   return GetPerformanceInfo(&perf, sizeof(perf)) ? (int64_t)perf.SystemCache * perf.PageSize : -1;
+}
+
+/**
+ * Writes at least 'bytes' of the generated lines to a new file without going through the file
+ * system cache, so a read of the file starts with none of it cached.  Unbuffered writes must be
+ * whole sectors, so each chunk ends with its last whole line followed by a line of spaces.
+ * Returns the number of lines written, or -1 if the file can't be written.
+ */
+int64_t createUncachedFile(const fs::path &path, const Inputs &in, int64_t bytes) {
+   unique_handle<GenericHandlePolicy> handle(CreateFile(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+                                                        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH, NULL));
+   unique_handle<VirtualMemoryPolicy> buffer(VirtualAlloc(NULL, CATCHUP_WRITE_LEN, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+   if (handle.get() == INVALID_HANDLE_VALUE || !buffer) {
+      return -1;
+   }
+   std::string data;
+   while (data.size() < CATCHUP_WRITE_LEN) {
+      data += in.block;
+   }
+   size_t len = data.rfind('\n', CATCHUP_WRITE_LEN - 3) + 1;
+   char *chunk = (char *)buffer.get();
+   memcpy(chunk, data.data(), len);
+   memset(chunk + len, ' ', CATCHUP_WRITE_LEN - len - 2);
+   memcpy(chunk + CATCHUP_WRITE_LEN - 2, "\r\n", 2);
+   int64_t chunkLines = std::count(chunk, chunk + CATCHUP_WRITE_LEN, '\n');
+   int64_t lines = 0;
+   for (int64_t written = 0; written < bytes; written += CATCHUP_WRITE_LEN) {
+      DWORD bytesWritten = 0;
+      if (!WriteFile(handle.get(), chunk, CATCHUP_WRITE_LEN, &bytesWritten, NULL) || bytesWritten != CATCHUP_WRITE_LEN) {
+         return -1;
+      }
+      lines += chunkLines;
+   }
+   return lines;
+}
+
+/**
+ * Catches up on 'bytes' of unread lines with tailer's ReadFile engine and with its --nocache
+ * engine, each on a file of its own that was written past the cache, and prints how much the
+ * system file cache grew during each read next to its time.  What tailer prints goes to 'nul'.
+ */
+void measureCatchUp(const Inputs &in, int64_t bytes, const std::regex &filter, HANDLE nul) {
+   static const std::pair<ReadEngine, const char *> engines[] = { {ReadEngine::ReadFile, "ReadFile"}, {ReadEngine::NoCache, "nocache"} };
+   std::cout << std::endl << std::left << std::setw(10) << "stage" << std::setw(28) << "engine" << std::right << std::setw(10) << "lines"
+             << std::setw(10) << "MB" << std::setw(12) << "ms" << std::setw(10) << "MB/s" << std::setw(16) << "cache growth MB" << std::endl;
+   uint64_t checksum = 0;
+   for (auto &engine : engines) {
+      if (!std::regex_search(std::string("catchup ") + engine.second, filter)) {
+         continue;
+      }
+      fs::path path = in.dir / (std::string("catchup_") + engine.second + ".log");
+      int64_t lines = createUncachedFile(path, in, bytes);
+      if (lines < 0) {
+         std::cerr << "Unable to write " << path << ": " << get_last_error() << std::endl;
+         continue;
+      }
+      BenchResult result;
+      uint64_t nanos;
+      int64_t cacheBefore, cacheAfter;
+      {
+         std::error_code ec;
+         ReadTarget target(path, systemFileSystem, systemClock);
+         int64_t size = (int64_t)fs::file_size(path, ec);
+         HANDLE hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
+         SetStdHandle(STD_OUTPUT_HANDLE, nul);
+         NullBuffer nullBuffer;
+         std::streambuf *coutBuffer = std::cout.rdbuf(&nullBuffer);
+         cacheBefore = system_cache_bytes();
+         int64_t start = perf_counter();
+         result = readRange(target, size, (uint64_t)lines, engine.first);
+         nanos = std::max<uint64_t>(perf_nanos(perf_counter() - start), 1);
+         cacheAfter = system_cache_bytes();
+         std::cout.rdbuf(coutBuffer);
+         SetStdHandle(STD_OUTPUT_HANDLE, hStdout);
+      }
+      std::error_code ec;
+      fs::remove(path, ec);   // its cached pages go with it, so the next engine starts from the same cache
+
+      std::cout << std::left << std::setw(10) << "catchup" << std::setw(28) << engine.second << std::right
+                << std::setw(10) << result.items << std::fixed << std::setprecision(1)
+                << std::setw(10) << result.bytes / (1024.0 * 1024.0) << std::setw(12) << nanos / 1e6
+                << std::setw(10) << result.bytes * 1e3 / nanos;
+      if (cacheBefore >= 0 && cacheAfter >= 0) {
+         std::cout << std::setw(16) << (cacheAfter - cacheBefore) / (1024.0 * 1024.0);
+      } else {
+         std::cout << std::setw(16) << "-";
+      }
+      std::cout << (checksum != 0 && checksum != result.checksum ? "  RESULT DIFFERS" : "") << std::endl;
+      checksum = result.checksum;
+   }
+}
+
+/**
+ * Runs the benchmark until at least 'millis' have passed (and at least three times), and prints
+ * the time per item and the throughput of the fastest run, and the bytes copied per byte of
+ * input where the benchmark counts them.  What tailer's engines print goes to 'nul'.
+ */
+void runBenchmark(const Benchmark &bench, unsigned millis, HANDLE nul, std::map<std::string, uint64_t> &checksums) {
+   HANDLE hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
+   SetStdHandle(STD_OUTPUT_HANDLE, nul);
+   NullBuffer nullBuffer;
+   std::streambuf *coutBuffer = std::cout.rdbuf(&nullBuffer);
+   BenchResult result = bench.run();   // warm up
+   uint64_t best = UINT64_MAX;
+   uint64_t total = 0;
+   unsigned runs = 0;
+   while (runs < 3 || total < millis * 1000000ull) {
+      int64_t start = perf_counter();
+      result = bench.run();
+      uint64_t nanos = perf_nanos(perf_counter() - start);
+      best = std::min(best, std::max<uint64_t>(nanos, 1));
+      total += nanos;
+      runs++;
+   }
+   std::cout.rdbuf(coutBuffer);
+   SetStdHandle(STD_OUTPUT_HANDLE, hStdout);
+
+   auto it = checksums.emplace(bench.stage, result.checksum).first;
+   std::cout << std::left << std::setw(10) << bench.stage << std::setw(28) << bench.engine << std::right
+             << std::setw(10) << result.items << std::fixed << std::setprecision(1)
+             << std::setw(12) << (double)best / result.items
+             << std::setw(12) << result.items * 1e3 / best;
+   if (result.bytes > 0) {
+      std::cout << std::setw(10) << result.bytes * 1e3 / best;
+   } else {
+      std::cout << std::setw(10) << "-";
+   }
+   if (result.copied >= 0 && result.bytes > 0) {
+      std::cout << std::setprecision(2) << std::setw(8) << (double)result.copied / result.bytes;
+   } else {
+      std::cout << std::setw(8) << "-";
+   }
+   std::cout << std::setw(8) << runs << (it->second != result.checksum ? "  RESULT DIFFERS" : "") << std::endl;
+}
+
+/**
+ * Command-line argument parser
+ */
+class BenchArgs {
+private:
+   args::ArgumentParser parser;
+   args::HelpFlag help;
+   args::ValueFlag<std::string> filter;
+   args::ValueFlag<int> millis;
+   args::ValueFlag<int> lines;
+   args::ValueFlag<int> files;
+   args::ValueFlag<int> prefixes;
+   args::ValueFlag<int> seed;
+   args::ValueFlag<std::string> dir;
+   args::ValueFlag<int> catchup_gb;
+   int stat{0};
+
+public:
+   BenchArgs(int argc, char *argv[]) :
+         parser("Microbenchmarks of tailer's line splitting, timestamp and layout parsing, beep, filter, search and file name matching, directory scan, polling pass, prefix map diff, output formatting and read engines.  Each stage runs with tailer's original implementation and tailer's own engines on the same generated inputs.  Optionally measures how much a large catch-up read grows the file cache with and without --nocache."),
+         help(parser, "help", "Display this help menu", {'h', "help"}),
+         filter(parser, "regex", "Only run the benchmarks whose 'stage engine' matches, e.g. \"beep|scan\".", {'f', "filter"}),
+         millis(parser, "millis", "Minimum time each benchmark runs (defaults to 500).", {'t', "time"}),
+         lines(parser, "lines", "Number of generated log lines (defaults to 100000).", {'l', "lines"}),
+         files(parser, "files", "Number of generated file names in the scanned directory, and of files polled by the pass benchmark (defaults to 1000).", {'n', "files"}),
+         prefixes(parser, "prefixes", "Number of prefixes in the diffed maps (defaults to 500).", {'p', "prefixes"}),
+         seed(parser, "seed", "Seed of the input generator (defaults to 42).", {'s', "seed"}),
+         dir(parser, "directory", "Scratch directory for the scan, pass and read benchmarks (defaults to microbench.tmp, removed afterwards).", {'d', "dir"}),
+         catchup_gb(parser, "gigabytes", "Also catch up on a file of this size once with ReadFile and once with --nocache, and show how much the system file cache grew during each read (defaults to 0, not measured).  The file is written to the scratch directory twice, one at a time.", {"catchup"})
+   {
+      try {
+         parser.ParseCLI(argc, argv);
+      } catch (args::Help) {
+         showHelp();
+      } catch (args::ParseError e) {
+         std::cerr << e.what() << std::endl;
+         std::cerr << parser;
+         stat = -1;
+      } catch (args::ValidationError e) {
+         std::cerr << e.what() << std::endl;
+         std::cerr << parser;
+         stat = -1;
+      }
+   }
+
+   int getStat() {  return stat;  }
+   bool getHelp() { return help ? true : false;  }
+   void showHelp() {  std::cout << parser; }
+   std::string getFilter() {  return filter ? args::get(filter) : ""; }
+   unsigned getMillis() {  return millis ? (unsigned)std::max(1, args::get(millis)) : 500; }
+   unsigned getLines() {  return lines ? (unsigned)std::max(1, args::get(lines)) : 100000; }
+   unsigned getFiles() {  return files ? (unsigned)std::max(1, args::get(files)) : 1000; }
+   unsigned getPrefixes() {  return prefixes ? (unsigned)std::max(1, args::get(prefixes)) : 500; }
+   unsigned getSeed() {  return seed ? (unsigned)args::get(seed) : 42; }
+   std::string getDir() {  return dir ? args::get(dir) : "microbench.tmp"; }
+   int64_t getCatchUpBytes() {  return catchup_gb ? (int64_t)std::max(0, args::get(catchup_gb)) * 1024 * 1024 * 1024 : 0; }
+};
+
+int main(int argc, char *argv[]) {
+   BenchArgs args(argc, argv);
+   if (args.getStat() != 0) {
+      return args.getStat();
+   } else if (args.getHelp()) {
+      return 0;
+   }
+   std::regex filter;
+   try {
+      filter = std::regex(args.getFilter());
+   } catch (std::regex_error &e) {
+      std::cerr << "Invalid argument: " << e.what() << std::endl;
+      return 1;
+   }
+   unique_handle<GenericHandlePolicy> nul(CreateFile(L"NUL", GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL));
+   if (nul.get() == INVALID_HANDLE_VALUE) {
+      std::cerr << "Unable to open NUL: " << get_last_error() << std::endl;
+      return 1;
+   }
+
+   Inputs in;
+   std::mt19937 random(args.getSeed());
+   generateLines(random, args.getLines(), in);
+   generateFileNames(random, args.getFiles(), in);
+   generateMaps(random, args.getPrefixes(), in);
+   in.dir = fs::absolute(fs::path(args.getDir()));
+   createFiles(args.getFiles(), in);
+
+   std::cout << std::left << std::setw(10) << "stage" << std::setw(28) << "engine" << std::right << std::setw(10) << "items"
+             << std::setw(12) << "ns/item" << std::setw(12) << "Mitems/s" << std::setw(10) << "MB/s" << std::setw(8) << "copies"
+             << std::setw(8) << "runs" << std::endl;
+   std::map<std::string, uint64_t> checksums;
+   {
+      std::vector<Benchmark> benchmarks = createBenchmarks(in);
+      for (auto &bench : benchmarks) {
+         if (std::regex_search(bench.stage + " " + bench.engine, filter)) {
+            runBenchmark(bench, args.getMillis(), nul.get(), checksums);
+         }
+      }
+   }
+   if (args.getCatchUpBytes() > 0) {
+      measureCatchUp(in, args.getCatchUpBytes(), filter, nul.get());
+   }
+
+   std::error_code ec;
+   fs::remove_all(in.dir, ec);
+   return 0;
+}
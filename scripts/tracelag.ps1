@@ -0,0 +1,127 @@
+<#
+.SYNOPSIS
+   Records tailer's tracepoints and reports the lag of each watched file.
+
+.DESCRIPTION
+   tailer writes its tracepoints (see tailer\Trace.h) to the ETW TraceLogging provider "Tailer"
+   {BE6EA449-C2D7-456F-80CB-5E15A8621E2A}.  -Start starts a trace session that records them
+   to an .etl file and -Stop stops it; both use logman, so nothing beyond Windows is needed, and
+   tailer doesn't have to be restarted.  The trace (the one just recorded with -Stop, or any
+   other with -Etl) is converted with tracerpt and for every prefix the script prints:
+
+      lag        file last written (FileRead.WriteTime) to the next batch written to stdout (Flush)
+      detect     file last written to tailer finding the appended data (FileRead)
+      reads      FileRead events, bytes the data they announced
+
+   plus the number of passes and their average and maximum duration (PollEnd).  The session
+   records at the information level; use -Lines to also record the Line and RegexMatch events.
+
+.EXAMPLE
+   .\tracelag.ps1 -Start
+   (reproduce the problem)
+   .\tracelag.ps1 -Stop
+
+.EXAMPLE
+   .\tracelag.ps1 -Etl D:\traces\tailer.etl
+#>
+param(
+   [switch]$Start,
+   [switch]$Stop,
+   [string]$Etl = "tailer.etl",
+   [switch]$Lines
+)
+
+$ErrorActionPreference = "Stop"
+$Provider = "{BE6EA449-C2D7-456F-80CB-5E15A8621E2A}"
+$Session = "tailer-trace"
+
+if ($Start) {
+   $level = if ($Lines) { "0x5" } else { "0x4" }
+   logman start $Session -p $Provider 0xffffffffffffffff $level -o $Etl -ets | Out-Null
+   Write-Host "Recording to $Etl, stop with: .\tracelag.ps1 -Stop -Etl $Etl"
+   return
+}
+if ($Stop) {
+   logman stop $Session -ets | Out-Null
+}
+
+# tracerpt decodes the self-describing TraceLogging events into XML
+$xmlFile = [System.IO.Path]::ChangeExtension([System.IO.Path]::GetFullPath($Etl), ".xml")
+tracerpt $Etl -o $xmlFile -of XML -y | Out-Null
+[xml]$trace = Get-Content -LiteralPath $xmlFile -Raw
+
+function Get-EventTime($record) {
+   # FILETIME precision is 100 ns, DateTime can't parse more than 7 fractional digits
+   $text = $record.System.TimeCreated.SystemTime -replace '(\.\d{7})\d*', '$1'
+   return [DateTime]::Parse($text).ToUniversalTime()
+}
+
+function Get-Percentile([double[]]$sorted, [double]$percent) {
+   if ($sorted.Count -eq 0) { return 0 }
+   $index = [Math]::Min($sorted.Count - 1, [Math]::Max(0, [int][Math]::Ceiling($percent / 100 * $sorted.Count) - 1))
+   return $sorted[$index]
+}
+
+$epoch = [DateTime]::new(1970, 1, 1, 0, 0, 0, [DateTimeKind]::Utc)
+$pending = New-Object System.Collections.Generic.List[object]   # FileRead events waiting for the next Flush that writes
+$files = @{}
+$passes = 0
+$passMicros = 0.0
+$passMax = 0.0
+
+foreach ($record in $trace.Events.Event) {
+   if ($record.System.Provider.Guid -ne $Provider -and $record.System.Provider.Name -ne "Tailer") { continue }
+   $name = if ($record.RenderingInfo.Task) { $record.RenderingInfo.Task } else { $record.System.Task }
+   $data = @{}
+   foreach ($field in $record.EventData.Data) { $data[$field.Name] = $field.'#text' }
+   $time = Get-EventTime $record
+
+   switch ($name) {
+      "FileRead" {
+         $prefix = $data["Prefix"]
+         if (-not $files.ContainsKey($prefix)) {
+            $files[$prefix] = [pscustomobject]@{ Reads = 0; Bytes = 0; Detect = New-Object System.Collections.Generic.List[double]; Lag = New-Object System.Collections.Generic.List[double] }
+         }
+         $written = $epoch.AddMilliseconds([double]$data["WriteTime"])
+         $stats = $files[$prefix]
+         $stats.Reads++
+         $stats.Bytes += [int64]$data["Bytes"]
+         $stats.Detect.Add(($time - $written).TotalMilliseconds)
+         $pending.Add([pscustomobject]@{ Prefix = $prefix; Written = $written })
+      }
+      "Flush" {
+         # the lines of a read go out with the first flush after it that writes something
+         if ([int64]$data["Bytes"] -gt 0) {
+            foreach ($read in $pending) {
+               $files[$read.Prefix].Lag.Add(($time - $read.Written).TotalMilliseconds)
+            }
+            $pending.Clear()
+         }
+      }
+      "PollEnd" {
+         $micros = [double]$data["Micros"]
+         $passes++
+         $passMicros += $micros
+         $passMax = [Math]::Max($passMax, $micros)
+      }
+   }
+}
+
+$rows = foreach ($prefix in ($files.Keys | Sort-Object)) {
+   $stats = $files[$prefix]
+   $lag = [double[]]($stats.Lag | Sort-Object)
+   $detect = [double[]]($stats.Detect | Sort-Object)
+   [pscustomobject]@{
+      Prefix        = $prefix
+      Reads         = $stats.Reads
+      Bytes         = $stats.Bytes
+      "Detect p50"  = [Math]::Round((Get-Percentile $detect 50), 1)
+      "Lag p50"     = [Math]::Round((Get-Percentile $lag 50), 1)
+      "Lag p99"     = [Math]::Round((Get-Percentile $lag 99), 1)
+      "Lag max"     = [Math]::Round((Get-Percentile $lag 100), 1)
+   }
+}
+$rows | Format-Table -AutoSize
+if ($passes -gt 0) {
+   Write-Host ("{0} passes, {1:N0} us average, {2:N0} us max (lags in ms)" -f $passes, ($passMicros / $passes), $passMax)
+}
@@ -0,0 +1,629 @@
+// simbench.cpp : Runs tailer's polling loop against a simulated file system and clock.  Seeded
+// scenarios of writers appending, rotating, truncating and deleting their logs play out in
+// memory, so thousands of rotation races run in seconds, a seed always plays out the same way,
+// and every line written is looked up in what tailer printed, so lines lost, printed twice or
+// printed out of order show up as a mismatch.  With --disk the same scenarios play out on real
+// files, still on the simulated clock, so they also run through the I/O engines that need a real
+// file handle (--overlapped, --nocache, --mmap and --passthrough).
+//
+
+#define TAILER_NO_MAIN
+#include "../tailer/tailer.cpp"
+#include <random>
+
+///////////////////////////////////////////////////////////////////////////////
+// constants
+//
+
+/** directory of the simulated logs and tailer's default file name pattern */
+const char SIM_DIR[]{ "logs" };
+const char SIM_FILE_PATTERN[]{ "(ess.*|tfe.*)_\\d+\\.log" };
+
+/** fraction of the writes that end in the middle of a line */
+const double PARTIAL_FRACTION{ 0.1 };
+
+/** fraction of the logs closed with the start of a line that is never finished, like a writer that died */
+const double UNFINISHED_FRACTION{ 0.1 };
+
+/** fraction of the bursts that are large enough for a catch-up read, on real files only */
+const double LARGE_BURST_FRACTION{ 0.2 };
+
+/** lines in a large burst -- they take more than CATCHUP_THRESHOLD (and MMAP_THRESHOLD) bytes */
+const unsigned LARGE_BURST_LINES{ (unsigned)(CATCHUP_THRESHOLD / 50) };
+
+/** longest time a writer stays idle, in simulated milliseconds */
+const unsigned MAX_IDLE_MILLIS{ 3000 };
+
+/** directory in the temp directory that the real log files are written to (--disk) */
+const char DISK_DIR_NAME[]{ "simbench.logs" };
+
+/** file in the temp directory that tailer's output is captured in to be checked */
+const char CAPTURE_FILE_NAME[]{ "simbench.out" };
+
+/** what every line written contains after the writer's prefix in brackets, followed by its sequence number */
+const char LINE_MARKER[]{ "] simulated message " };
+
+/** what a line that is never finished contains after the writer's prefix */
+const char UNFINISHED_MARKER[]{ "] unfinished" };
+
+/** passes a copytruncate waits at most for tailer to read the log (a rotated file can take the grace time) */
+const unsigned MAX_WAIT_PASSES{ 20 };
+
+///////////////////////////////////////////////////////////////////////////////
+// types
+//
+
+/** a process writing a log named <prefix>_<number>.log */
+struct Writer {
+   std::string prefix;
+   unsigned number{1};
+   fs::path path;
+   uint64_t seq{0};            // sequence number of the last line started
+   unsigned backups{0};        // files renamed away so far
+   unsigned unfinished{0};     // files left with an unterminated last line
+   std::string partial;        // rest of a line whose start was written already
+   uint64_t createdPass{0};    // tailer passes done when the file was created
+};
+
+/** totals over all the scenarios */
+struct SimTotals {
+   uint64_t scenarios{0};
+   uint64_t mismatches{0};
+   uint64_t written{0};
+   uint64_t printed{0};
+   uint64_t lost{0};
+   uint64_t duplicated{0};
+   uint64_t passes{0};
+   int64_t passTicks{0};
+   int64_t passMax{0};
+   uint64_t rotations{0};
+   uint64_t truncations{0};
+   uint64_t deletions{0};
+   LatencyHistogram detectLatency;   // simulated time from a write to its lines being printed
+};
+
+/** how the scenarios are run */
+struct SimOptions {
+   fs::path diskDir;              // directory of real log files, or empty to simulate the files
+   bool overlapped{false};        // the overlapped I/O engine reads the files
+   bool bypassCache{false};       // catch-up reads bypass the file system cache
+   bool mapLargeReads{false};     // large appended ranges are split from mapped views
+   bool rawPassthrough{false};    // lines are printed without a prefix, copied as they are
+};
+
+/** the FILETIME of a time in milliseconds since 1970-01-01, see filetime_to_unix_time() */
+FILETIME unix_time_to_filetime(int64_t millis) {
+   ULARGE_INTEGER ticks;
+   ticks.QuadPart = (uint64_t)millis * 10000 + 0x019DB1DED53E8000;
+   FILETIME fileTime;
+   fileTime.dwLowDateTime = ticks.LowPart;
+   fileTime.dwHighDateTime = ticks.HighPart;
+   return fileTime;
+}
+
+/** the writers' side of the log files, and the file system tailer sees them through */
+class LogFiles {
+public:
+   virtual ~LogFiles() {}
+   virtual FileSystem &getFileSystem() = 0;
+   /** creates an empty file, or truncates an existing one */
+   virtual void create(const fs::path &path) = 0;
+   virtual void append(const fs::path &path, const std::string &text) = 0;
+   virtual void truncate(const fs::path &path, size_t size) = 0;
+   virtual void rename(const fs::path &from, const fs::path &to) = 0;
+   virtual void remove(const fs::path &path) = 0;
+};
+
+/** logs kept in memory by a SimulatedFileSystem */
+class SimulatedLogFiles : public LogFiles {
+private:
+   SimulatedFileSystem fileSystem;
+
+public:
+   SimulatedLogFiles(Clock &clock) : fileSystem{clock} {}
+
+   FileSystem &getFileSystem() override { return fileSystem; }
+   void create(const fs::path &path) override { fileSystem.create(path); }
+   void append(const fs::path &path, const std::string &text) override { fileSystem.append(path, text); }
+   void truncate(const fs::path &path, size_t size) override { fileSystem.truncate(path, size); }
+   void rename(const fs::path &from, const fs::path &to) override { fileSystem.rename(from, to); }
+   void remove(const fs::path &path) override { fileSystem.remove(path); }
+};
+
+/**
+ * Real log files in a directory that is emptied first.  Each change sets the file times from the
+ * simulated clock, so tailer sees the same times as with the simulated files and a file created
+ * right after another one is still the newer one.
+ */
+class DiskLogFiles : public LogFiles {
+private:
+   Clock &clock;
+   SystemFileSystem fileSystem;
+
+   unique_handle<GenericHandlePolicy> openForWrite(const fs::path &path, DWORD access, DWORD disposition) {
+      HANDLE handle = CreateFile(path.c_str(), access | FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                 NULL, disposition, FILE_ATTRIBUTE_NORMAL, NULL);
+      return unique_handle<GenericHandlePolicy>(handle != INVALID_HANDLE_VALUE ? handle : NULL);
+   }
+
+   void setTimes(HANDLE handle, bool created) {
+      FILETIME now = unix_time_to_filetime(clock.currentTime());
+      SetFileTime(handle, created ? &now : NULL, NULL, &now);
+   }
+
+public:
+   DiskLogFiles(Clock &c, const fs::path &dir) : clock{c} {
+      std::error_code ec;
+      fs::create_directories(dir, ec);
+      std::vector<FileEntry> old;
+      fileSystem.listFiles(dir, old);
+      for (FileEntry &entry : old) {
+         DeleteFile(entry.path.c_str());
+      }
+   }
+
+   FileSystem &getFileSystem() override { return fileSystem; }
+
+   void create(const fs::path &path) override {
+      unique_handle<GenericHandlePolicy> file = openForWrite(path, GENERIC_WRITE, CREATE_ALWAYS);
+      if (file) {
+         setTimes(file.get(), true);
+      }
+   }
+
+   void append(const fs::path &path, const std::string &text) override {
+      unique_handle<GenericHandlePolicy> file = openForWrite(path, FILE_APPEND_DATA, OPEN_EXISTING);
+      if (file) {
+         for (size_t pos = 0; pos < text.size(); ) {
+            DWORD written = 0;
+            if (!WriteFile(file.get(), text.data() + pos, (DWORD)std::min<size_t>(text.size() - pos, MAXDWORD), &written, NULL) || written == 0) {
+               break;
+            }
+            pos += written;
+         }
+         setTimes(file.get(), false);
+      }
+   }
+
+   void truncate(const fs::path &path, size_t size) override {
+      unique_handle<GenericHandlePolicy> file = openForWrite(path, GENERIC_WRITE, OPEN_EXISTING);
+      LARGE_INTEGER length;
+      length.QuadPart = (LONGLONG)size;
+      if (file && SetFilePointerEx(file.get(), length, NULL, FILE_BEGIN)) {
+         SetEndOfFile(file.get());
+         setTimes(file.get(), false);
+      }
+   }
+
+   void rename(const fs::path &from, const fs::path &to) override {
+      MoveFileEx(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING);
+   }
+
+   void remove(const fs::path &path) override {
+      DeleteFile(path.c_str());
+   }
+};
+
+/** discards what tailer prints about the files it watches */
+class NullBuffer : public std::streambuf {
+protected:
+   int overflow(int ch) override { return ch; }
+};
+
+/**
+ * One scenario: a few writers, each appending to its own log and now and then rotating it to a
+ * new numbered file, renaming it away, truncating it (copytruncate) or deleting it.  A pass of
+ * the polling loop runs every POLLING_INTERVAL_MILLIS of simulated time.  A writer only rotates
+ * a file once tailer had a pass to find it, like a real writer that doesn't rotate a log twice
+ * within a poll, and truncates it only after tailer has read it, since copytruncate loses
+ * whatever wasn't read before the truncation.
+ */
+class Scenario {
+private:
+   std::mt19937 random;
+   SimulatedClock clock;
+   std::unique_ptr<LogFiles> files;
+   fs::path logdir;
+   const std::regex &filename_regex;
+   std::vector<Writer> writers;
+   TailContext ctx;
+   std::unique_ptr<OverlappedReader> reader;
+   std::shared_ptr<PrefixLogFileInfoMap> pmap;
+   HANDLE capture;            // tailer's stdout
+   bool onDisk;
+   ULONGLONG nextPass{0};
+   bool renamed{false};       // a file was created, renamed or deleted since the last pass
+   uint64_t written{0};       // complete lines written
+   uint64_t printed{0};       // lines of the writers that tailer printed
+   uint64_t lost{0};          // lines written but not printed
+   uint64_t duplicated{0};    // lines printed again or out of order
+
+   void pass() {
+      pollFiles(pmap, renamed, logdir, filename_regex, (unsigned)writers.size(), ctx);
+      renamed = false;
+      nextPass = clock.tickCount() + POLLING_INTERVAL_MILLIS;
+   }
+
+   /** moves the clock on, running the passes that fall due on the way */
+   void advance(ULONGLONG millis) {
+      ULONGLONG until = clock.tickCount() + millis;
+      while (nextPass <= until) {
+         clock.advance(nextPass - clock.tickCount());
+         pass();
+      }
+      clock.advance(until - clock.tickCount());
+   }
+
+   void waitForPass() {
+      advance(nextPass - clock.tickCount());
+   }
+
+   unsigned pick(unsigned count) {
+      return std::uniform_int_distribution<unsigned>(0, count - 1)(random);
+   }
+
+   std::string nextLine(Writer &w) {
+      return "2022-02-16 22:48:48,320 INFO  [" + w.prefix + "] simulated message " + std::to_string(++w.seq) + "\r\n";
+   }
+
+   void append(Writer &w, unsigned lines) {
+      std::string text;
+      if (!w.partial.empty()) {
+         text.swap(w.partial);
+         written++;
+      }
+      for (unsigned i = 0; i < lines; i++) {
+         text += nextLine(w);
+      }
+      written += lines;
+      if (std::bernoulli_distribution(PARTIAL_FRACTION)(random)) {
+         std::string line = nextLine(w);
+         size_t split = 1 + pick((unsigned)line.size() - 2);
+         text += line.substr(0, split);
+         w.partial = line.substr(split);
+      }
+      files->append(w.path, text);
+   }
+
+   /** a writer finishes its last line before it closes its log */
+   void finishLine(Writer &w) {
+      if (!w.partial.empty()) {
+         files->append(w.path, w.partial);
+         w.partial.clear();
+         written++;
+      }
+   }
+
+   void createFile(Writer &w) {
+      w.path = logdir / (w.prefix + "_" + std::to_string(w.number) + ".log");
+      files->create(w.path);
+      w.createdPass = ctx.stats.passes;
+      renamed = true;
+   }
+
+   /** waits until tailer has read all of the log, since copytruncate loses whatever it hadn't */
+   void waitUntilRead(Writer &w) {
+      FileStatus status;
+      files->getFileSystem().getStatus(w.path, status);
+      for (unsigned i = 0; i < MAX_WAIT_PASSES; i++) {
+         waitForPass();
+         auto it = pmap->find(w.prefix);
+         if (it != pmap->end() && !it->second->getPredecessor() && it->second->getLastTailedPosition() >= status.size) {
+            return;
+         }
+      }
+   }
+
+   /**
+    * Closes the log of the writer, after tailer had a pass to find it.  Now and then the log ends
+    * with the start of a line that is never finished, which tailer prints once it is done with the
+    * file.
+    */
+   void closeFile(Writer &w) {
+      finishLine(w);
+      if (std::bernoulli_distribution(UNFINISHED_FRACTION)(random)) {
+         files->append(w.path, "2022-02-16 22:48:48,320 INFO  [" + w.prefix + UNFINISHED_MARKER);
+         w.unfinished++;
+      }
+      if (ctx.stats.passes == w.createdPass) {
+         waitForPass();
+      }
+   }
+
+   /** everything tailer printed in this scenario */
+   std::string readOutput() {
+      ctx.sink.flush();
+      std::string output;
+      LARGE_INTEGER size;
+      LARGE_INTEGER start{};
+      if (GetFileSizeEx(capture, &size) && SetFilePointerEx(capture, start, NULL, FILE_BEGIN)) {
+         output.resize((size_t)size.QuadPart);
+         size_t pos = 0;
+         DWORD bytesRead = 0;
+         while (pos < output.size() && ReadFile(capture, &output[pos], (DWORD)std::min<size_t>(output.size() - pos, MAXDWORD), &bytesRead, NULL)
+                && bytesRead > 0) {
+            pos += bytesRead;
+         }
+         output.resize(pos);
+      }
+      return output;
+   }
+
+   /**
+    * Finds the lines of the writers in tailer's output by the prefix and sequence number they
+    * contain.  The lines of each writer must be printed exactly once and in the order written;
+    * a sequence number skipped counts as lost, and one at or below a number printed before counts
+    * as duplicated, which covers lines printed twice and lines printed out of order.  Matching
+    * lines instead of counting them keeps a lost line and a duplicated one from cancelling out.
+    * The unfinished lines carry no sequence number and are only counted.
+    */
+   void checkOutput(const std::string &output) {
+      std::unordered_map<std::string, uint64_t> next;         // next sequence number expected, per prefix
+      std::unordered_map<std::string, unsigned> unfinished;   // unfinished lines printed, per prefix
+      for (Writer &w : writers) {
+         next[w.prefix] = 1;
+      }
+      size_t markerLen = strlen(LINE_MARKER);
+      for (size_t pos = 0; pos < output.size(); ) {
+         std::string line = output.substr(pos, output.find('\n', pos) - pos);
+         pos += line.size() + 1;
+         size_t marker = line.find(LINE_MARKER);
+         bool complete = marker != std::string::npos;
+         if (!complete) {
+            marker = line.find(UNFINISHED_MARKER);
+         }
+         size_t open = marker != std::string::npos ? line.rfind('[', marker) : std::string::npos;
+         auto it = open != std::string::npos ? next.find(line.substr(open + 1, marker - open - 1)) : next.end();
+         if (it == next.end()) {
+            continue;
+         } else if (!complete) {
+            unfinished[it->first]++;
+            continue;
+         }
+         uint64_t seq = strtoull(line.c_str() + marker + markerLen, nullptr, 10);
+         printed++;
+         if (seq < it->second) {
+            duplicated++;
+         } else {
+            lost += seq - it->second;
+            it->second = seq + 1;
+         }
+      }
+      for (Writer &w : writers) {
+         uint64_t expected = next[w.prefix];
+         lost += w.seq >= expected ? w.seq + 1 - expected : 0;
+         unsigned count = unfinished[w.prefix];
+         lost += w.unfinished > count ? w.unfinished - count : 0;
+         duplicated += count > w.unfinished ? count - w.unfinished : 0;
+      }
+   }
+
+public:
+   /** 'out' is the handle tailer prints to, it is emptied for this scenario */
+   Scenario(unsigned seed, unsigned writerCount, const std::regex &filenameRegex, HANDLE out, const SimOptions &opts) :
+         random{seed}, filename_regex{filenameRegex}, capture{out}, onDisk{!opts.diskDir.empty()} {
+      LARGE_INTEGER start{};
+      SetFilePointerEx(capture, start, NULL, FILE_BEGIN);
+      SetEndOfFile(capture);
+      if (onDisk) {
+         logdir = opts.diskDir;
+         files.reset(new DiskLogFiles(clock, logdir));
+      } else {
+         logdir = SIM_DIR;
+         files.reset(new SimulatedLogFiles(clock));
+      }
+      ctx.pclock = &clock;
+      ctx.pfs = &files->getFileSystem();
+      ctx.stats.latency = true;
+      ctx.bypassCache = opts.bypassCache;
+      ctx.mapLargeReads = opts.mapLargeReads;
+      ctx.showPrefix = !opts.rawPassthrough;
+      ctx.rawPassthrough = opts.rawPassthrough;
+      if (opts.overlapped) {
+         reader.reset(new OverlappedReader());
+         ctx.preader = reader->isValid() ? reader.get() : nullptr;
+      }
+      for (unsigned i = 0; i < writerCount; i++) {
+         Writer w;
+         w.prefix = "tfe" + std::string(1, (char)('A' + i % 26)) + (i >= 26 ? std::to_string(i / 26) : "");
+         writers.push_back(w);
+         createFile(writers.back());
+      }
+      renamed = false;
+      pmap = collectInitialLogFiles(logdir, filename_regex, writerCount, files->getFileSystem(), clock);
+      nextPass = clock.tickCount() + POLLING_INTERVAL_MILLIS;
+   }
+
+   /** plays 'steps' random writer actions, then lets tailer catch up and checks what it printed */
+   void run(unsigned steps, SimTotals &totals) {
+      for (unsigned step = 0; step < steps; step++) {
+         advance(1 + pick(100));
+         Writer &w = writers[pick((unsigned)writers.size())];
+         unsigned action = pick(100);
+         if (action < 70) {
+            append(w, 1 + pick(20));
+         } else if (action < 75) {
+            bool large = onDisk && std::bernoulli_distribution(LARGE_BURST_FRACTION)(random);
+            append(w, large ? LARGE_BURST_LINES : 200 + pick(2000));   // burst
+         } else if (action < 83) {
+            closeFile(w);                          // rotation to a new numbered file
+            w.number++;
+            createFile(w);
+            totals.rotations++;
+         } else if (action < 88) {
+            closeFile(w);                          // rotation by renaming the log away
+            files->rename(w.path, logdir / (w.prefix + "_" + std::to_string(w.number) + "." + std::to_string(++w.backups) + ".bak"));
+            createFile(w);
+            totals.rotations++;
+         } else if (action < 92) {
+            finishLine(w);                         // copytruncate
+            waitUntilRead(w);
+            files->truncate(w.path, 0);
+            totals.truncations++;
+         } else if (action < 95) {
+            closeFile(w);                          // deleted while tailer has it open
+            files->remove(w.path);
+            w.number++;
+            createFile(w);
+            totals.deletions++;
+         } else {
+            advance(pick(MAX_IDLE_MILLIS));
+         }
+      }
+      for (Writer &w : writers) {
+         finishLine(w);
+      }
+      // long enough for the rotated and deleted files to be drained and released
+      advance(std::max<ULONGLONG>(ROTATION_GRACE_MILLIS, ctx.drainMillis) + 3 * POLLING_INTERVAL_MILLIS);
+      flushHeldLines(pmap, ctx);
+      checkOutput(readOutput());
+
+      totals.scenarios++;
+      totals.written += written;
+      totals.printed += printed;
+      totals.lost += lost;
+      totals.duplicated += duplicated;
+      totals.passes += ctx.stats.passes;
+      totals.passTicks += ctx.stats.passTotal;
+      totals.passMax = std::max(totals.passMax, ctx.stats.passMax);
+      totals.detectLatency.add(ctx.stats.detectLatency);
+      if (isMismatch()) {
+         totals.mismatches++;
+      }
+   }
+
+   bool isMismatch() const { return lost > 0 || duplicated > 0; }
+
+   std::string describe() const {
+      return "wrote " + std::to_string(written) + " lines, printed " + std::to_string(printed) + ", "
+             + std::to_string(lost) + " lost, " + std::to_string(duplicated) + " duplicated or out of order";
+   }
+};
+
+/**
+ * Command-line argument parser
+ */
+class SimArgs {
+private:
+   args::ArgumentParser parser;
+   args::HelpFlag help;
+   args::ValueFlag<int> scenarios;
+   args::ValueFlag<int> steps;
+   args::ValueFlag<int> writers;
+   args::ValueFlag<int> seed;
+   args::Flag disk;
+   args::Flag overlapped;
+   args::Flag nocache;
+   args::Flag mmap;
+   args::Flag passthrough;
+   int stat{0};
+
+public:
+   SimArgs(int argc, char *argv[]) :
+         parser("Runs tailer's polling loop against a simulated file system and clock.  Each seeded scenario has writers appending to, rotating, truncating and deleting their logs, and checks that tailer prints every line written exactly once and in order."),
+         help(parser, "help", "Display this help menu", {'h', "help"}),
+         scenarios(parser, "scenarios", "Number of scenarios (defaults to 1000).", {'n', "scenarios"}),
+         steps(parser, "steps", "Writer actions per scenario (defaults to 200).", {'s', "steps"}),
+         writers(parser, "writers", "Writers (and log files) per scenario (defaults to 4).", {'w', "writers"}),
+         seed(parser, "seed", "Seed of the first scenario, the others use the following seeds (defaults to 1).", {'r', "seed"}),
+         disk(parser, "disk", "Write the logs as real files in simbench.logs in the temp directory instead of simulating them.  Some of the bursts are then large enough for catch-up reads.", {'d', "disk"}),
+         overlapped(parser, "overlapped", "Read the files with the overlapped I/O engine (implies --disk).", {'o', "overlapped"}),
+         nocache(parser, "nocache", "Bypass the file system cache for catch-up reads (implies --disk).", {"nocache"}),
+         mmap(parser, "mmap", "Split large appended ranges from mapped views (implies --disk).", {"mmap"}),
+         passthrough(parser, "passthrough", "Print the lines without a prefix, which copies the appended data to stdout as it is (implies --disk).", {"passthrough"})
+   {
+      try {
+         parser.ParseCLI(argc, argv);
+      } catch (args::Help) {
+         showHelp();
+      } catch (args::ParseError e) {
+         std::cerr << e.what() << std::endl;
+         std::cerr << parser;
+         stat = -1;
+      } catch (args::ValidationError e) {
+         std::cerr << e.what() << std::endl;
+         std::cerr << parser;
+         stat = -1;
+      }
+   }
+
+   int getStat() {  return stat;  }
+   bool getHelp() { return help ? true : false;  }
+   void showHelp() {  std::cout << parser; }
+   unsigned getScenarios() {  return scenarios ? (unsigned)std::max(1, args::get(scenarios)) : 1000; }
+   unsigned getSteps() {  return steps ? (unsigned)std::max(1, args::get(steps)) : 200; }
+   unsigned getWriters() {  return writers ? (unsigned)std::max(1, args::get(writers)) : 4; }
+   unsigned getSeed() {  return seed ? (unsigned)args::get(seed) : 1; }
+   bool getDisk() {  return disk || getOverlapped() || getNocache() || getMmap() || getPassthrough(); }
+   bool getOverlapped() {  return overlapped ? true : false; }
+   bool getNocache() {  return nocache ? true : false; }
+   bool getMmap() {  return mmap ? true : false; }
+   bool getPassthrough() {  return passthrough ? true : false; }
+};
+
+int main(int argc, char *argv[]) {
+   SimArgs args(argc, argv);
+   if (args.getStat() != 0) {
+      return args.getStat();
+   } else if (args.getHelp()) {
+      return 0;
+   }
+
+   // the lines tailer prints go to a temporary file that each scenario checks, its messages about
+   // the files to a null buffer
+   fs::path capturePath = fs::temp_directory_path() / CAPTURE_FILE_NAME;
+   unique_handle<GenericHandlePolicy> capture(CreateFile(capturePath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+                                                         FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL));
+   if (capture.get() == INVALID_HANDLE_VALUE) {
+      std::cerr << "Unable to create " << capturePath << ": " << get_last_error() << std::endl;
+      return 1;
+   }
+   HANDLE hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
+   SetStdHandle(STD_OUTPUT_HANDLE, capture.get());
+   NullBuffer nullBuffer;
+   std::streambuf *coutBuffer = std::cout.rdbuf(&nullBuffer);
+
+   SimOptions opts;
+   if (args.getDisk()) {
+      opts.diskDir = fs::temp_directory_path() / DISK_DIR_NAME;
+   }
+   opts.overlapped = args.getOverlapped();
+   opts.bypassCache = args.getNocache();
+   opts.mapLargeReads = args.getMmap();
+   opts.rawPassthrough = args.getPassthrough();
+
+   std::regex filename_regex(SIM_FILE_PATTERN);
+   SimTotals totals;
+   std::vector<std::string> failures;
+   int64_t start = perf_counter();
+   for (unsigned i = 0; i < args.getScenarios(); i++) {
+      Scenario scenario(args.getSeed() + i, args.getWriters(), filename_regex, capture.get(), opts);
+      scenario.run(args.getSteps(), totals);
+      if (scenario.isMismatch()) {
+         failures.push_back("seed " + std::to_string(args.getSeed() + i) + ": " + scenario.describe());
+      }
+   }
+   double seconds = perf_nanos(perf_counter() - start) / 1e9;
+   if (!opts.diskDir.empty()) {
+      std::error_code ec;
+      fs::remove_all(opts.diskDir, ec);
+   }
+
+   std::cout.rdbuf(coutBuffer);
+   SetStdHandle(STD_OUTPUT_HANDLE, hStdout);
+   for (const std::string &failure : failures) {
+      std::cout << "MISMATCH " << failure << std::endl;
+   }
+   std::cout << std::fixed << std::setprecision(1)
+             << "scenarios:       " << totals.scenarios << " in " << seconds << " s (" << totals.mismatches << " mismatched)" << std::endl
+             << "lines:           " << totals.written << " written, " << totals.printed << " printed, " << totals.lost << " lost, "
+             << totals.duplicated << " duplicated or out of order" << std::endl
+             << "events:          " << totals.rotations << " rotations, " << totals.truncations << " truncations, "
+             << totals.deletions << " deletions" << std::endl
+             << "passes:          " << totals.passes << ", " << (totals.passes > 0 ? Statistics::micros(totals.passTicks) / (double)totals.passes : 0.0)
+             << " us average, " << Statistics::micros(totals.passMax) << " us max" << std::endl
+             << "detect latency:  p50 " << totals.detectLatency.percentile(50) / 1e6 << " ms, p99 "
+             << totals.detectLatency.percentile(99) / 1e6 << " ms, max " << totals.detectLatency.getMax() / 1e6
+             << " ms (simulated time)" << std::endl;
+   return totals.mismatches > 0 ? 1 : 0;
+}
@@ -0,0 +1,223 @@
+#pragma once
+
+// File system and clock access of the polling loop.  tailer itself uses the Win32 implementations
+// (SystemClock and SystemFileSystem in tailer.cpp); the simulated ones below keep the files in
+// memory and only move the clock when told to, so rotation, truncation and timing scenarios run
+// deterministically and without any real I/O.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <Windows.h>
+
+namespace fs = std::experimental::filesystem::v1;
+
+/**
+ * Identifies a file independently of its name: the volume serial number and the file index,
+ * which stay the same when the file is renamed.
+ */
+struct FileIdentity {
+   DWORD volume{0};
+   uint64_t index{0};
+
+   bool isValid() const { return volume != 0 || index != 0; }
+   bool operator==(const FileIdentity &other) const { return volume == other.volume && index == other.index; }
+   bool operator!=(const FileIdentity &other) const { return !(*this == other); }
+};
+
+/** times (milliseconds since 1970-01-01), size and identity of a file */
+struct FileStatus {
+   int64_t createTime{0};
+   int64_t writeTime{0};
+   int64_t size{0};
+   FileIdentity identity;
+};
+
+/** a file found by FileSystem::listFiles() with the times and size from the directory listing */
+struct FileEntry {
+   fs::path path;
+   FileStatus status;
+};
+
+/** monotonic tick count (like GetTickCount64) and wall clock time */
+class Clock {
+public:
+   virtual ~Clock() {}
+   virtual ULONGLONG tickCount() = 0;
+   /** milliseconds since 1970-01-01 */
+   virtual int64_t currentTime() = 0;
+};
+
+/** a file opened for reading, which may be renamed or deleted while it is open */
+class OpenFile {
+public:
+   virtual ~OpenFile() {}
+   virtual bool query(FileStatus &status) = 0;
+   /** synchronous positional read */
+   virtual bool readAt(int64_t pos, char *buf, DWORD len, DWORD &bytesRead) = 0;
+   /** true if the file was deleted but is still open, see LogFileInfo::isDeletedButOpen() */
+   virtual bool isDeletedButOpen() = 0;
+   /** the Win32 handle for the I/O engines that need one, or NULL if the file isn't a real file */
+   virtual HANDLE getHandle() = 0;
+};
+
+class FileSystem {
+public:
+   virtual ~FileSystem() {}
+   /** the files (not directories) in 'dir'; their identity isn't filled in */
+   virtual void listFiles(const fs::path &dir, std::vector<FileEntry> &files) = 0;
+   /** times and size of the file; the identity is only filled in by getIdentity() and OpenFile::query() */
+   virtual bool getStatus(const fs::path &path, FileStatus &status) = 0;
+   virtual FileIdentity getIdentity(const fs::path &path) = 0;
+   /** opens the file for reading, returns null if it can't be opened */
+   virtual std::shared_ptr<OpenFile> open(const fs::path &path, bool overlapped) = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// simulation
+//
+
+/** clock that only moves when advance() is called */
+class SimulatedClock : public Clock {
+private:
+   ULONGLONG ticks;
+   int64_t epoch;          // currentTime() at tick 0
+
+public:
+   SimulatedClock(int64_t startTime = 1645051728320LL, ULONGLONG startTicks = 1000000) : ticks{startTicks}, epoch{startTime - (int64_t)startTicks} {}
+
+   ULONGLONG tickCount() override { return ticks; }
+   int64_t currentTime() override { return epoch + (int64_t)ticks; }
+   void advance(ULONGLONG millis) { ticks += millis; }
+};
+
+/**
+ * In-memory file system.  Files are kept by full path; a file that is renamed keeps its
+ * identity, and a file that is deleted while open stays readable through the open file (with
+ * isDeletedButOpen() set) like a file deleted with FILE_SHARE_DELETE on Windows.  Write and
+ * create times come from the clock.
+ */
+class SimulatedFileSystem : public FileSystem {
+private:
+   struct File {
+      std::string data;
+      int64_t createTime;
+      int64_t writeTime;
+      uint64_t index;
+      bool deleted{false};
+   };
+
+   class SimulatedOpenFile : public OpenFile {
+   private:
+      std::shared_ptr<File> file;
+   public:
+      SimulatedOpenFile(std::shared_ptr<File> f) : file{f} {}
+      bool query(FileStatus &status) override {
+         status.createTime = file->createTime;
+         status.writeTime = file->writeTime;
+         status.size = (int64_t)file->data.size();
+         status.identity = FileIdentity{1, file->index};
+         return true;
+      }
+      bool readAt(int64_t pos, char *buf, DWORD len, DWORD &bytesRead) override {
+         bytesRead = pos < (int64_t)file->data.size() ? (DWORD)std::min<int64_t>(len, file->data.size() - pos) : 0;
+         if (bytesRead > 0) {
+            memcpy(buf, file->data.data() + pos, bytesRead);
+         }
+         return true;
+      }
+      bool isDeletedButOpen() override { return file->deleted; }
+      HANDLE getHandle() override { return NULL; }
+   };
+
+   Clock &clock;
+   std::map<std::string, std::shared_ptr<File>> files;
+   uint64_t nextIndex{1};
+
+   std::shared_ptr<File> find(const fs::path &path) const {
+      auto it = files.find(path.string());
+      return it != files.end() ? it->second : nullptr;
+   }
+
+public:
+   SimulatedFileSystem(Clock &c) : clock{c} {}
+
+   void listFiles(const fs::path &dir, std::vector<FileEntry> &entries) override {
+      for (auto &entry : files) {
+         fs::path path(entry.first);
+         if (path.parent_path() == dir) {
+            FileEntry found{path};
+            getStatus(path, found.status);
+            entries.push_back(found);
+         }
+      }
+   }
+
+   bool getStatus(const fs::path &path, FileStatus &status) override {
+      std::shared_ptr<File> file = find(path);
+      if (file) {
+         status.createTime = file->createTime;
+         status.writeTime = file->writeTime;
+         status.size = (int64_t)file->data.size();
+      }
+      return file ? true : false;
+   }
+
+   FileIdentity getIdentity(const fs::path &path) override {
+      std::shared_ptr<File> file = find(path);
+      return file ? FileIdentity{1, file->index} : FileIdentity{};
+   }
+
+   std::shared_ptr<OpenFile> open(const fs::path &path, bool overlapped) override {
+      std::shared_ptr<File> file = find(path);
+      return file ? std::make_shared<SimulatedOpenFile>(file) : nullptr;
+   }
+
+   /** creates an empty file, or truncates an existing one */
+   void create(const fs::path &path) {
+      std::shared_ptr<File> &file = files[path.string()];
+      if (!file) {
+         file = std::make_shared<File>(File{"", clock.currentTime(), clock.currentTime(), nextIndex++});
+      }
+      truncate(path, 0);
+   }
+
+   void append(const fs::path &path, const std::string &text) {
+      std::shared_ptr<File> file = find(path);
+      if (file) {
+         file->data += text;
+         file->writeTime = clock.currentTime();
+      }
+   }
+
+   void truncate(const fs::path &path, size_t size) {
+      std::shared_ptr<File> file = find(path);
+      if (file && size <= file->data.size()) {
+         file->data.resize(size);
+         file->writeTime = clock.currentTime();
+      }
+   }
+
+   /** replaces the file at 'to' if there is one */
+   void rename(const fs::path &from, const fs::path &to) {
+      std::shared_ptr<File> file = find(from);
+      if (file) {
+         remove(to);
+         files.erase(from.string());
+         files[to.string()] = file;
+      }
+   }
+
+   void remove(const fs::path &path) {
+      std::shared_ptr<File> file = find(path);
+      if (file) {
+         file->deleted = true;
+         files.erase(path.string());
+      }
+   }
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+/**
+ * Histogram of latencies in nanoseconds in the style of HdrHistogram: every power of 2 is split
+ * into 16 linear sub-buckets, so any value is kept to within 1/16 (6%) of itself over the whole
+ * 64-bit range, in a fixed 8 KB array with a constant-time record().
+ */
+class LatencyHistogram {
+private:
+   static const unsigned SUB_BITS = 4;
+   static const unsigned SUB_COUNT = 1 << SUB_BITS;
+   static const unsigned BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+   uint64_t counts[BUCKETS]{};
+   uint64_t total{0};
+   uint64_t maxValue{0};
+
+   static unsigned highestBit(uint64_t v) {
+      unsigned bit = 0;
+      for (unsigned step = 32; step > 0; step /= 2) {
+         if ((v >> step) != 0) {
+            v >>= step;
+            bit += step;
+         }
+      }
+      return bit;
+   }
+
+   static unsigned bucketOf(uint64_t v) {
+      if (v < SUB_COUNT) {
+         return (unsigned)v;
+      }
+      unsigned shift = highestBit(v) - SUB_BITS;
+      return (shift + 1) * SUB_COUNT + (unsigned)((v >> shift) & (SUB_COUNT - 1));
+   }
+
+   /** highest value that falls into the bucket */
+   static uint64_t highestOf(unsigned bucket) {
+      if (bucket < SUB_COUNT) {
+         return bucket;
+      }
+      unsigned shift = bucket / SUB_COUNT - 1;
+      return ((uint64_t)(SUB_COUNT + bucket % SUB_COUNT + 1) << shift) - 1;
+   }
+
+public:
+   void record(uint64_t nanos) {
+      counts[bucketOf(nanos)]++;
+      total++;
+      maxValue = std::max(maxValue, nanos);
+   }
+
+   /** adds the values recorded in another histogram */
+   void add(const LatencyHistogram &other) {
+      for (unsigned bucket = 0; bucket < BUCKETS; bucket++) {
+         counts[bucket] += other.counts[bucket];
+      }
+      total += other.total;
+      maxValue = std::max(maxValue, other.maxValue);
+   }
+
+   uint64_t getCount() const { return total; }
+   uint64_t getMax() const { return maxValue; }
+
+   /** value that 'percent' percent of the recorded values are at or below */
+   uint64_t percentile(double percent) const {
+      uint64_t target = (uint64_t)(percent / 100.0 * total + 0.5);
+      uint64_t seen = 0;
+      for (unsigned bucket = 0; bucket < BUCKETS; bucket++) {
+         seen += counts[bucket];
+         if (seen >= std::max<uint64_t>(target, 1)) {
+            return std::min(highestOf(bucket), maxValue);
+         }
+      }
+      return maxValue;
+   }
+};
@@ -0,0 +1,341 @@
+#pragma once
+
+// Line filter expressions such as
+//
+//    level>=WARN and prefix==tfe and msg~"Timeout"
+//
+// An expression is compiled once into a flat program of tests and conditional jumps that is run
+// against the spans of each line, so selecting or dropping a line never allocates.  Patterns
+// without regex special characters are searched for as literals.
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <regex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "LogLayout.h"
+
+/**
+ * Pattern matched by the ~ and !~ operators: a regex, or a Boyer-Moore-Horspool search when the
+ * pattern is a plain string.
+ */
+class LinePattern {
+private:
+   typedef std::boyer_moore_horspool_searcher<std::string::const_iterator> Searcher;
+   std::string literal;
+   std::unique_ptr<Searcher> searcher;
+   std::unique_ptr<std::regex> regex;
+
+public:
+   LinePattern(const std::string &pattern) : literal{pattern} {
+      if (pattern.find_first_of(".^$|()[]{}*+?\\") != std::string::npos) {
+         regex.reset(new std::regex(pattern));
+      } else if (!literal.empty()) {
+         searcher.reset(new Searcher(literal.begin(), literal.end()));
+      }
+   }
+
+   bool search(std::string_view text) const {
+      if (regex) {
+         return std::regex_search(text.begin(), text.end(), *regex);
+      } else if (searcher) {
+         return std::search(text.begin(), text.end(), *searcher) != text.end();
+      }
+      return true;
+   }
+};
+
+/** values a line is tested against, see LineFilter::matches() */
+struct FilterInput {
+   std::string_view prefix;
+   std::string_view line;
+   const LineFields *pfields;
+};
+
+/**
+ * Filter expression compiled from
+ *
+ *    expr    := term { "or" term }
+ *    term    := factor { "and" factor }
+ *    factor  := "not" factor | "(" expr ")" | field op value
+ *    field   := level | prefix | thread | msg | line
+ *    op      := == | != | < | <= | > | >= | ~ | !~
+ *
+ * where a value is a word or a double quoted string and ~ searches for a regular expression.
+ * level is compared by severity; the other fields only support ==, != , ~ and !~.
+ */
+class LineFilter {
+private:
+   enum class Field { Level, Prefix, Thread, Message, Line };
+   enum class Op { Eq, Ne, Lt, Le, Gt, Ge, Match, NoMatch, JumpIfFalse, JumpIfTrue, Not };
+
+   struct Instruction {
+      Op op;
+      Field field;
+      LogLevel level;
+      size_t arg;       // index of the string or pattern, or the jump target
+   };
+
+   std::string source;
+   std::vector<Instruction> program;
+   std::vector<std::string> strings;
+   std::vector<std::unique_ptr<LinePattern>> patterns;
+   bool usesLayout{false};
+
+   // tokenizer
+   size_t pos{0};
+   std::string token;
+   bool quoted{false};
+
+   [[noreturn]] void error(const std::string &what) const {
+      throw std::invalid_argument(what + " at position " + std::to_string(pos) + " of filter '" + source + "'");
+   }
+
+   void next() {
+      while (pos < source.size() && isspace((unsigned char)source[pos])) {
+         pos++;
+      }
+      token.clear();
+      quoted = false;
+      if (pos == source.size()) {
+         return;
+      }
+      char ch = source[pos];
+      if (ch == '"') {
+         quoted = true;
+         for (pos++; pos < source.size() && source[pos] != '"'; pos++) {
+            if (source[pos] == '\\' && pos + 1 < source.size()) {
+               pos++;
+            }
+            token += source[pos];
+         }
+         if (pos == source.size()) {
+            error("unterminated string");
+         }
+         pos++;
+      } else if (ch == '(' || ch == ')' || ch == '~') {
+         token = source.substr(pos++, 1);
+      } else if (strchr("=!<>", ch) != nullptr) {
+         token = source.substr(pos++, 1);
+         if (pos < source.size() && (source[pos] == '=' || (ch == '!' && source[pos] == '~'))) {
+            token += source[pos++];
+         }
+      } else {
+         while (pos < source.size() && !isspace((unsigned char)source[pos]) && strchr("()~=!<>\"", source[pos]) == nullptr) {
+            token += source[pos++];
+         }
+      }
+   }
+
+   bool accept(const char *word) {
+      if (!quoted && token == word) {
+         next();
+         return true;
+      }
+      return false;
+   }
+
+   size_t emit(Op op, Field field = Field::Line, LogLevel level = LogLevel::None, size_t arg = 0) {
+      program.push_back(Instruction{op, field, level, arg});
+      return program.size() - 1;
+   }
+
+   void expr() {
+      std::vector<size_t> jumps;
+      term();
+      while (accept("or")) {
+         jumps.push_back(emit(Op::JumpIfTrue));
+         term();
+      }
+      for (size_t jump : jumps) {
+         program[jump].arg = program.size();
+      }
+   }
+
+   void term() {
+      std::vector<size_t> jumps;
+      factor();
+      while (accept("and")) {
+         jumps.push_back(emit(Op::JumpIfFalse));
+         factor();
+      }
+      for (size_t jump : jumps) {
+         program[jump].arg = program.size();
+      }
+   }
+
+   void factor() {
+      if (accept("not")) {
+         factor();
+         emit(Op::Not);
+      } else if (accept("(")) {
+         expr();
+         if (!accept(")")) {
+            error("expected ')'");
+         }
+      } else {
+         test();
+      }
+   }
+
+   void test() {
+      Field field;
+      if (accept("level")) {
+         field = Field::Level;
+      } else if (accept("prefix")) {
+         field = Field::Prefix;
+      } else if (accept("thread")) {
+         field = Field::Thread;
+      } else if (accept("msg")) {
+         field = Field::Message;
+      } else if (accept("line")) {
+         field = Field::Line;
+      } else {
+         error("expected level, prefix, thread, msg or line");
+      }
+      static const char *const opNames[] = { "==", "!=", "<", "<=", ">", ">=", "~", "!~" };
+      size_t opIndex = 0;
+      while (opIndex < 8 && (quoted || token != opNames[opIndex])) {
+         opIndex++;
+      }
+      if (opIndex == 8) {
+         error("expected a comparison");
+      }
+      Op op = (Op)opIndex;
+      next();
+      if (token.empty() && !quoted) {
+         error("expected a value");
+      }
+      if (field == Field::Level) {
+         if (op == Op::Match || op == Op::NoMatch) {
+            error("level can't be matched with a pattern");
+         }
+         LogLevel level = parse_level(token.data(), token.size());
+         if (level == LogLevel::None) {
+            error("unknown level '" + token + "'");
+         }
+         emit(op, field, level);
+      } else if (op == Op::Match || op == Op::NoMatch) {
+         patterns.emplace_back(new LinePattern(token));
+         emit(op, field, LogLevel::None, patterns.size() - 1);
+      } else if (op == Op::Eq || op == Op::Ne) {
+         strings.push_back(token);
+         emit(op, field, LogLevel::None, strings.size() - 1);
+      } else {
+         error("only level can be compared with < <= > >=");
+      }
+      usesLayout |= field == Field::Level || field == Field::Thread || field == Field::Message;
+      next();
+   }
+
+   static std::string quote(const std::string &s) {
+      std::string q = "\"";
+      for (char ch : s) {
+         if (ch == '"' || ch == '\\') {
+            q += '\\';
+         }
+         q += ch;
+      }
+      return q + '"';
+   }
+
+   static std::string_view text(const Instruction &ins, const FilterInput &input) {
+      switch (ins.field) {
+      case Field::Prefix: return input.prefix;
+      case Field::Thread: return input.pfields->thread;
+      case Field::Message: return input.pfields->message;
+      default: return input.line;
+      }
+   }
+
+public:
+   /**
+    * Compiles the expression (which may be empty) and the --include and --exclude patterns: a
+    * line must match the expression, at least one of the includes and none of the excludes.
+    * Throws std::invalid_argument or std::regex_error if any of them is invalid.
+    */
+   LineFilter(const std::string &expression, const std::vector<std::string> &includes, const std::vector<std::string> &excludes) {
+      std::vector<std::string> parts;
+      if (!expression.empty()) {
+         parts.push_back("(" + expression + ")");
+      }
+      std::string any;
+      for (auto &include : includes) {
+         any += (any.empty() ? "(line ~ " : " or line ~ ") + quote(include);
+      }
+      if (!any.empty()) {
+         parts.push_back(any + ")");
+      }
+      for (auto &exclude : excludes) {
+         parts.push_back("line !~ " + quote(exclude));
+      }
+      for (auto &part : parts) {
+         source += (source.empty() ? "" : " and ") + part;
+      }
+      next();
+      if (!token.empty() || quoted) {
+         expr();
+         if (!token.empty() || quoted) {
+            error("unexpected '" + token + "'");
+         }
+      }
+   }
+
+   bool isEmpty() const { return program.empty(); }
+   const std::string &getSource() const { return source; }
+
+   /** true if the expression tests the level, thread or msg fields of the line layout */
+   bool needsLayout() const { return usesLayout; }
+
+   /** runs the program on the line; 'pfields' in the input may only be null if !needsLayout() */
+   bool matches(const FilterInput &input) const {
+      bool result = true;
+      for (size_t pc = 0; pc < program.size(); pc++) {
+         const Instruction &ins = program[pc];
+         switch (ins.op) {
+         case Op::JumpIfFalse:
+            if (!result) {
+               pc = ins.arg - 1;
+            }
+            continue;
+         case Op::JumpIfTrue:
+            if (result) {
+               pc = ins.arg - 1;
+            }
+            continue;
+         case Op::Not:
+            result = !result;
+            continue;
+         case Op::Match:
+            result = patterns[ins.arg]->search(text(ins, input));
+            continue;
+         case Op::NoMatch:
+            result = !patterns[ins.arg]->search(text(ins, input));
+            continue;
+         default:
+            break;
+         }
+         int cmp;
+         if (ins.field == Field::Level) {
+            cmp = (int)input.pfields->level - (int)ins.level;
+         } else {
+            cmp = text(ins, input).compare(strings[ins.arg]);
+         }
+         switch (ins.op) {
+         case Op::Eq: result = cmp == 0; break;
+         case Op::Ne: result = cmp != 0; break;
+         case Op::Lt: result = cmp < 0; break;
+         case Op::Le: result = cmp <= 0; break;
+         case Op::Gt: result = cmp > 0; break;
+         default:     result = cmp >= 0; break;
+         }
+      }
+      return result;
+   }
+};
@@ -0,0 +1,464 @@
+#pragma once
+
+// Parsing of the fields at the start of a log line, e.g.
+//
+//    2022-02-16 18:51:11,673 INFO [Exec Stream Pumper] - Listening for transport dt_socket at address: 8003
+//
+// The layouts are compiled once into fixed offsets and masks so a line is checked and split
+// without any per-character interpretation of the format: the timestamp is validated 8 bytes
+// at a time (SWAR) and the level is recognized from its first 4 bytes with a single compare.
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Days since 1970-01-01 for a date in the proleptic Gregorian calendar.
+ * (Howard Hinnant's days_from_civil algorithm)
+ */
+inline int64_t days_from_civil(int64_t y, unsigned m, unsigned d) {
+   y -= m <= 2;
+   const int64_t era = (y >= 0 ? y : y - 399) / 400;
+   const unsigned yoe = (unsigned)(y - era * 400);
+   const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+   const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+   return era * 146097 + (int64_t)doe - 719468;
+}
+
+/**
+ * Timestamp layout compiled from a strftime-like format string.  The supported fields are %Y
+ * (4 digit year), %m, %d, %H, %M, %S (2 digits each) and %f (3 digit milliseconds); any other
+ * character has to match literally.  Every field has a fixed width, so the timestamp always
+ * occupies the same (at most MAX_LENGTH) characters at the start of the line and is validated
+ * with one literal compare and one digit check per 8 bytes.
+ */
+class TimestampFormat {
+public:
+   enum Field { Year, Month, Day, Hour, Minute, Second, Millis, FIELD_COUNT };
+   static const size_t MAX_LENGTH = 32;
+
+private:
+   static const size_t WORDS = MAX_LENGTH / 8;
+   std::string format;
+   size_t length{0};
+   int offsets[FIELD_COUNT];
+   uint64_t digitMask[WORDS]{};      // 0xff in every byte that must be a digit
+   uint64_t literalMask[WORDS]{};    // 0xff in every byte that must match literals[]
+   uint64_t literals[WORDS]{};
+
+   static unsigned widthOf(Field field) {
+      return field == Year ? 4 : (field == Millis ? 3 : 2);
+   }
+
+   static uint64_t load(const char *p, size_t n) {
+      uint64_t word = 0;
+      memcpy(&word, p, n);
+      return word;
+   }
+
+   unsigned value(const char *line, Field field, unsigned missing) const {
+      if (offsets[field] < 0) {
+         return missing;
+      }
+      const char *p = line + offsets[field];
+      unsigned v = 0;
+      for (unsigned i = 0; i < widthOf(field); i++) {
+         v = v * 10 + (unsigned)(p[i] - '0');
+      }
+      return v;
+   }
+
+   void reserve(unsigned width) {
+      if (length + width > MAX_LENGTH) {
+         throw std::invalid_argument("timestamp format is longer than 32 characters");
+      }
+   }
+
+   void addLiteral(char ch) {
+      reserve(1);
+      literalMask[length / 8] |= (uint64_t)0xff << (8 * (length % 8));
+      literals[length / 8] |= (uint64_t)(unsigned char)ch << (8 * (length % 8));
+      length++;
+   }
+
+public:
+   TimestampFormat(const std::string &fmt = "%Y-%m-%d %H:%M:%S,%f") : format{fmt} {
+      for (int &offset : offsets) {
+         offset = -1;
+      }
+      for (size_t i = 0; i < fmt.size(); i++) {
+         if (fmt[i] != '%' || i + 1 == fmt.size()) {
+            addLiteral(fmt[i]);
+         } else {
+            Field field;
+            switch (fmt[++i]) {
+            case 'Y': field = Year; break;
+            case 'm': field = Month; break;
+            case 'd': field = Day; break;
+            case 'H': field = Hour; break;
+            case 'M': field = Minute; break;
+            case 'S': field = Second; break;
+            case 'f': field = Millis; break;
+            case '%': addLiteral('%'); continue;
+            default:
+               throw std::invalid_argument(std::string("unsupported timestamp field %") + fmt[i]);
+            }
+            reserve(widthOf(field));
+            offsets[field] = (int)length;
+            for (unsigned w = 0; w < widthOf(field); w++, length++) {
+               digitMask[length / 8] |= (uint64_t)0xff << (8 * (length % 8));
+            }
+         }
+      }
+   }
+
+   const std::string &getFormat() const { return format; }
+   size_t getLength() const { return length; }
+
+   /**
+    * Parses the timestamp at the start of the line into milliseconds since 1970-01-01 (the time
+    * zone is not known, so the result is only useful for comparing timestamps in the same
+    * format).  Returns false if the line doesn't start with a timestamp in this format.
+    */
+   bool parse(const char *line, size_t len, int64_t &millis) const {
+      if (len < length) {
+         return false;
+      }
+      for (size_t w = 0; w * 8 < length; w++) {
+         uint64_t word = load(line + w * 8, std::min<size_t>(8, length - w * 8));
+         if (((word ^ literals[w]) & literalMask[w]) != 0) {
+            return false;
+         }
+         // digits become 0..9, anything else has its high bit set either before or after adding 0x76
+         uint64_t t = word ^ 0x3030303030303030ULL;
+         if ((((t + 0x7676767676767676ULL) | t) & 0x8080808080808080ULL & digitMask[w]) != 0) {
+            return false;
+         }
+      }
+      unsigned month = value(line, Month, 1);
+      unsigned day = value(line, Day, 1);
+      if (month < 1 || month > 12 || day < 1 || day > 31) {
+         return false;
+      }
+      int64_t seconds = days_from_civil(value(line, Year, 1970), month, day) * 86400
+                      + value(line, Hour, 0) * 3600 + value(line, Minute, 0) * 60 + value(line, Second, 0);
+      millis = seconds * 1000 + value(line, Millis, 0);
+      return true;
+   }
+};
+
+/**
+ * Parses a --since time into milliseconds since 1970-01-01 in the same (time zone less) terms as
+ * TimestampFormat::parse, given the local time 'now' in those terms: a duration before now such as
+ * 90s, 10m, 2h or 1d, a time of day today (HH:MM or HH:MM:SS), or a date with an optional time of
+ * day (YYYY-MM-DD, YYYY-MM-DD HH:MM or YYYY-MM-DD HH:MM:SS, with a space or a T between them).
+ * Returns false if the text is none of these.
+ */
+inline bool parse_since(const std::string &text, int64_t now, int64_t &millis) {
+   size_t digits = 0;
+   while (digits < text.size() && isdigit((unsigned char)text[digits])) {
+      digits++;
+   }
+   if (digits > 0 && digits + 1 == text.size() && digits <= 9) {
+      int64_t count = std::stoll(text.substr(0, digits));
+      switch (text[digits]) {
+      case 's': millis = now - count * 1000; return true;
+      case 'm': millis = now - count * 60 * 1000; return true;
+      case 'h': millis = now - count * 3600 * 1000; return true;
+      case 'd': millis = now - count * 86400 * 1000; return true;
+      default:  return false;
+      }
+   }
+   auto field = [&text](size_t pos, unsigned &value) {
+      if (pos + 2 > text.size() || !isdigit((unsigned char)text[pos]) || !isdigit((unsigned char)text[pos + 1])) {
+         return false;
+      }
+      value = (text[pos] - '0') * 10 + (text[pos + 1] - '0');
+      return true;
+   };
+   unsigned century, year, month, day, hour, minute, second = 0;
+   int64_t days = now / (86400 * 1000);
+   size_t pos = 0;
+   if (digits == 4) {
+      if (text.size() < 10 || !field(0, century) || !field(2, year) || text[4] != '-' || !field(5, month) || text[7] != '-'
+          || !field(8, day) || month < 1 || month > 12 || day < 1 || day > 31) {
+         return false;
+      }
+      days = days_from_civil(century * 100 + year, month, day);
+      if (text.size() == 10) {
+         millis = days * 86400 * 1000;
+         return true;
+      }
+      if (text[10] != ' ' && text[10] != 'T') {
+         return false;
+      }
+      pos = 11;
+   }
+   if (!field(pos, hour) || pos + 2 >= text.size() || text[pos + 2] != ':' || !field(pos + 3, minute)) {
+      return false;
+   }
+   pos += 5;
+   if (pos < text.size() && (text[pos] != ':' || !field(pos + 1, second))) {
+      return false;
+   }
+   if ((pos < text.size() && pos + 3 != text.size()) || hour > 23 || minute > 59 || second > 59) {
+      return false;
+   }
+   millis = (days * 86400 + hour * 3600 + minute * 60 + second) * 1000;
+   return true;
+}
+
+/** log levels, in increasing order of severity */
+enum class LogLevel : unsigned char { None, Trace, Debug, Info, Warn, Error, Fatal };
+
+constexpr uint32_t chars4(char a, char b, char c, char d) {
+   return (uint32_t)(unsigned char)a | ((uint32_t)(unsigned char)b << 8) | ((uint32_t)(unsigned char)c << 16) | ((uint32_t)(unsigned char)d << 24);
+}
+
+/**
+ * Level named by a word such as INFO, WARN or WARNING, recognized (case insensitively) from its
+ * first 4 characters.  Returns LogLevel::None if the word isn't a level.
+ */
+inline LogLevel parse_level(const char *word, size_t len) {
+   if (len < 4) {
+      return LogLevel::None;
+   }
+   uint32_t first4;
+   memcpy(&first4, word, 4);
+   switch (first4 & 0xdfdfdfdf) {   // upper case
+   case chars4('T', 'R', 'A', 'C'): return LogLevel::Trace;
+   case chars4('F', 'I', 'N', 'E'):
+   case chars4('D', 'E', 'B', 'U'): return LogLevel::Debug;
+   case chars4('I', 'N', 'F', 'O'): return LogLevel::Info;
+   case chars4('W', 'A', 'R', 'N'): return LogLevel::Warn;
+   case chars4('S', 'E', 'V', 'E'):
+   case chars4('E', 'R', 'R', 'O'): return LogLevel::Error;
+   case chars4('C', 'R', 'I', 'T'):
+   case chars4('F', 'A', 'T', 'A'): return LogLevel::Fatal;
+   default: return LogLevel::None;
+   }
+}
+
+/** bit of the level in a mask of selected levels */
+constexpr unsigned level_bit(LogLevel level) {
+   return 1u << (unsigned)level;
+}
+
+/** mask that selects every level -- no line is filtered out */
+const unsigned ALL_LEVELS = level_bit(LogLevel::Fatal) * 2 - 1;
+
+/**
+ * Mask of the levels selected by a minimum level (e.g. "warn") and/or a comma separated list of
+ * levels (e.g. "debug,error"); when both are given a level must satisfy both.  Lines with a word
+ * that isn't a level in the level field are always selected.
+ */
+inline unsigned level_mask(const std::string &minLevel, const std::string &levels) {
+   unsigned mask = ALL_LEVELS;
+   if (!minLevel.empty()) {
+      LogLevel min = parse_level(minLevel.data(), minLevel.size());
+      if (min == LogLevel::None) {
+         throw std::invalid_argument("unknown level '" + minLevel + "'");
+      }
+      mask &= ~(level_bit(min) - 1) | level_bit(LogLevel::None);
+   }
+   if (!levels.empty()) {
+      unsigned listed = level_bit(LogLevel::None);
+      size_t start = 0;
+      while (start <= levels.size()) {
+         size_t comma = std::min(levels.find(',', start), levels.size());
+         std::string name = levels.substr(start, comma - start);
+         LogLevel level = parse_level(name.data(), name.size());
+         if (level == LogLevel::None) {
+            throw std::invalid_argument("unknown level '" + name + "'");
+         }
+         listed |= level_bit(level);
+         start = comma + 1;
+      }
+      mask &= listed;
+   }
+   return mask;
+}
+
+/** how the lines that continue a multi-line record (e.g. a stack trace) are recognized */
+enum class RecordRule { None, Indent, Java, Timestamp };
+
+/** rule named on the command line: indent, java or timestamp */
+inline RecordRule parse_record_rule(const std::string &name) {
+   if (name.empty()) {
+      return RecordRule::None;
+   } else if (name == "indent") {
+      return RecordRule::Indent;
+   } else if (name == "java") {
+      return RecordRule::Java;
+   } else if (name == "timestamp") {
+      return RecordRule::Timestamp;
+   }
+   throw std::invalid_argument("unknown record rule '" + name + "'");
+}
+
+/**
+ * Checks if the line continues the record started by an earlier line: it starts with white
+ * space (Indent), also with "at " or "Caused by" (Java), or it doesn't start with a timestamp in
+ * the given format (Timestamp).
+ */
+inline bool is_continuation(RecordRule rule, const TimestampFormat &format, const char *line, size_t len) {
+   switch (rule) {
+   case RecordRule::Indent:
+      return len > 0 && (line[0] == ' ' || line[0] == '\t');
+   case RecordRule::Java:
+      return (len > 0 && (line[0] == ' ' || line[0] == '\t'))
+          || (len >= 3 && memcmp(line, "at ", 3) == 0)
+          || (len >= 9 && memcmp(line, "Caused by", 9) == 0);
+   case RecordRule::Timestamp: {
+      int64_t millis;
+      return !format.parse(line, len, millis);
+   }
+   default:
+      return false;
+   }
+}
+
+/** fields found at the start of a log line -- the spans point into the line */
+struct LineFields {
+   int64_t millis{0};
+   LogLevel level{LogLevel::None};
+   std::string_view thread;
+   std::string_view message;
+};
+
+/**
+ * Layout of a whole log line compiled from a description such as "%T %L [%t] - %m": %T is the
+ * timestamp (in the given TimestampFormat), %L the level, %t the thread name and %m the message
+ * (the rest of the line).  Any other characters match literally; a run of spaces in the line
+ * matches a single space in the layout.  The level and the thread name end at the first
+ * character of the literal that follows them.
+ */
+class LineLayout {
+public:
+   enum class Field { Literal, Timestamp, Level, Thread, Message };
+
+private:
+   struct Item {
+      Field field;
+      std::string literal;
+   };
+   std::string layout;
+   TimestampFormat timestamp;
+   std::vector<Item> items;
+   size_t levelEnd{0};      // number of items up to and including the level (0 = no level)
+
+   void add(Field field) {
+      if (!items.empty() && items.back().field == Field::Message) {
+         throw std::invalid_argument("%m must be at the end of the layout");
+      }
+      items.push_back(Item{field, ""});
+   }
+
+public:
+   LineLayout(const std::string &desc = "%T %L [%t] - %m", const TimestampFormat &tsFormat = TimestampFormat())
+   : layout{desc}, timestamp{tsFormat} {
+      for (size_t i = 0; i < desc.size(); i++) {
+         if (desc[i] == '%' && i + 1 < desc.size() && desc[i + 1] != '%') {
+            switch (desc[++i]) {
+            case 'T': add(Field::Timestamp); break;
+            case 'L': add(Field::Level); levelEnd = items.size(); break;
+            case 't': add(Field::Thread); break;
+            case 'm': add(Field::Message); break;
+            default:
+               throw std::invalid_argument(std::string("unsupported layout field %") + desc[i]);
+            }
+         } else {
+            // %% is a literal %, and so is a lone % at the end like in TimestampFormat
+            if (desc[i] == '%' && i + 1 < desc.size()) {
+               ++i;
+            }
+            if (items.empty() || items.back().field != Field::Literal) {
+               add(Field::Literal);
+            }
+            items.back().literal += desc[i];
+         }
+      }
+   }
+
+   const std::string &getLayout() const { return layout; }
+   const TimestampFormat &getTimestampFormat() const { return timestamp; }
+   bool hasLevel() const { return levelEnd > 0; }
+
+   /**
+    * Splits the line into its fields.  Returns false (usually after looking at the first few
+    * bytes) if the line doesn't follow the layout, e.g. a stack trace or continuation line.
+    */
+   bool parse(const char *line, size_t len, LineFields &fields) const {
+      return parseItems(line, len, fields, items.size());
+   }
+
+   /**
+    * Finds the level of the line, looking no further than the level field.  Returns false if the
+    * start of the line doesn't follow the layout or the layout has no level.
+    */
+   bool parseLevel(const char *line, size_t len, LogLevel &level) const {
+      LineFields fields;
+      if (levelEnd == 0 || !parseItems(line, len, fields, levelEnd)) {
+         return false;
+      }
+      level = fields.level;
+      return true;
+   }
+
+private:
+   bool parseItems(const char *line, size_t len, LineFields &fields, size_t count) const {
+      const char *p = line;
+      const char *end = line + len;
+      for (size_t i = 0; i < count; i++) {
+         const Item &item = items[i];
+         switch (item.field) {
+         case Field::Literal: {
+            if (item.literal[0] == ' ') {
+               while (end - p > 1 && p[0] == ' ' && p[1] == ' ') {
+                  ++p;
+               }
+            }
+            size_t n = item.literal.size();
+            if ((size_t)(end - p) < n || memcmp(p, item.literal.data(), n) != 0) {
+               return false;
+            }
+            p += n;
+            break;
+         }
+         case Field::Timestamp:
+            if (!timestamp.parse(p, end - p, fields.millis)) {
+               return false;
+            }
+            p += timestamp.getLength();
+            break;
+         case Field::Level:
+         case Field::Thread: {
+            const char *stop = end;
+            if (i + 1 < items.size() && items[i + 1].field == Field::Literal) {
+               stop = (const char *)memchr(p, items[i + 1].literal[0], end - p);
+               if (stop == nullptr) {
+                  return false;
+               }
+            }
+            if (item.field == Field::Level) {
+               fields.level = parse_level(p, stop - p);
+            } else {
+               fields.thread = std::string_view(p, stop - p);
+            }
+            p = stop;
+            break;
+         }
+         case Field::Message:
+            fields.message = std::string_view(p, end - p);
+            p = end;
+            break;
+         }
+      }
+      return true;
+   }
+};
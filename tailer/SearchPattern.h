@@ -0,0 +1,177 @@
+#pragma once
+
+// Pattern of the --search mode.  Most patterns contain a run of plain characters that every
+// matching line has to contain, e.g. "Timeout" in "Timeout after \d+ ms".  The files are scanned
+// for that literal with memchr and memcmp, which the C runtime vectorizes, and only the lines it
+// is found in are split out and confirmed with the regex; a pattern that is a plain string isn't
+// compiled into a regex at all.
+
+#include <cctype>
+#include <cstring>
+#include <memory>
+#include <regex>
+#include <string>
+
+class SearchPattern {
+private:
+   std::string source;
+   std::string literal;                // every matching line contains it, empty if there is none
+   size_t anchor{0};                   // position of the literal's character looked for with memchr
+   std::unique_ptr<std::regex> regex;  // null when the pattern is the literal itself
+
+   /**
+    * Longest run of plain characters outside any group or class that a match of the pattern must
+    * contain, or "" if there is none.  Characters made optional by ? * or {} are left out, and a
+    * pattern with a top level | has no required literal.
+    */
+   static std::string requiredLiteral(const std::string &pattern) {
+      std::string best;
+      std::string run;
+      int depth = 0;
+      for (size_t i = 0; i < pattern.size(); i++) {
+         char ch = pattern[i];
+         bool plain = false;
+         bool optional = false;
+         switch (ch) {
+         case '\\':
+            // \d \w \b \1 and the like are classes, assertions or back references
+            if (i + 1 < pattern.size() && !isalnum((unsigned char)pattern[i + 1])) {
+               ch = pattern[++i];
+               plain = ch != '\r' && ch != '\n';
+            } else if (++i < pattern.size()) {
+               // skip the rest of \xhh, \uhhhh, \cX and back references such as \12
+               char escape = pattern[i];
+               size_t skip = escape == 'x' ? 2 : escape == 'u' ? 4 : escape == 'c' ? 1 : 0;
+               while (i + 1 < pattern.size() && (skip > 0 || (isdigit((unsigned char)escape) && isdigit((unsigned char)pattern[i + 1])))) {
+                  i++;
+                  skip -= skip > 0 ? 1 : 0;
+               }
+            }
+            break;
+         case '[':
+            for (i++; i < pattern.size() && pattern[i] != ']'; i++) {
+               if (pattern[i] == '\\') {
+                  i++;
+               }
+            }
+            break;
+         case '(':
+            depth++;
+            break;
+         case ')':
+            depth--;
+            break;
+         case '|':
+            if (depth == 0) {
+               return "";
+            }
+            break;
+         case '{':
+            while (i < pattern.size() && pattern[i] != '}') {
+               i++;
+            }
+            optional = true;
+            break;
+         case '?':
+         case '*':
+            optional = true;
+            break;
+         case '+':
+         case '.':
+         case '^':
+         case '$':
+            break;
+         default:
+            plain = true;
+            break;
+         }
+         if (optional && !run.empty()) {
+            run.pop_back();   // the character before the quantifier may not be there
+         }
+         if ((ch == '+' || optional) && i + 1 < pattern.size() && pattern[i + 1] == '?') {
+            i++;              // lazy quantifier
+         }
+         if (plain && depth == 0) {
+            run += ch;
+         } else {
+            if (run.size() > best.size()) {
+               best = run;
+            }
+            run.clear();
+         }
+      }
+      return run.size() > best.size() ? run : best;
+   }
+
+   /** first occurrence of the literal in [p, end), or null */
+   const char *findLiteral(const char *p, const char *end) const {
+      size_t n = literal.size();
+      while ((size_t)(end - p) >= n) {
+         const char *hit = (const char *)memchr(p + anchor, literal[anchor], (end - p) - n + 1);
+         if (hit == nullptr) {
+            return nullptr;
+         }
+         hit -= anchor;
+         if (memcmp(hit, literal.data(), n) == 0) {
+            return hit;
+         }
+         p = hit + 1;
+      }
+      return nullptr;
+   }
+
+public:
+   /** throws std::regex_error if the pattern is invalid */
+   SearchPattern(const std::string &pattern) : source{pattern} {
+      if (pattern.find_first_of(".^$|()[]{}*+?\\") == std::string::npos) {
+         literal = pattern;
+      } else {
+         regex.reset(new std::regex(pattern));
+         literal = requiredLiteral(pattern);
+      }
+      // lower case letters and spaces are the most common characters in log lines, so memchr
+      // stops less often on anything else
+      for (size_t i = 0; i < literal.size(); i++) {
+         if (!islower((unsigned char)literal[i]) && literal[i] != ' ') {
+            anchor = i;
+            break;
+         }
+      }
+   }
+
+   const std::string &getSource() const { return source; }
+   const std::string &getLiteral() const { return literal; }
+
+   /**
+    * Finds the first matching line in [p, end), where 'p' is at the start of a line.  Returns
+    * false if there is none; otherwise 'line' and 'len' are the line without its line break and
+    * 'next' is the start of the line after it.
+    */
+   bool find(const char *p, const char *end, const char *&line, size_t &len, const char *&next) const {
+      while (p < end) {
+         const char *hit = literal.empty() ? p : findLiteral(p, end);
+         if (hit == nullptr) {
+            return false;
+         }
+         const char *start = hit;
+         while (start > p && start[-1] != '\n') {
+            --start;
+         }
+         const char *eol = (const char *)memchr(hit, '\n', end - hit);
+         next = eol != nullptr ? eol + 1 : end;
+         if (eol == nullptr) {
+            eol = end;
+         }
+         if (eol > start && eol[-1] == '\r') {
+            --eol;
+         }
+         if (!regex || std::regex_search(start, eol, *regex)) {
+            line = start;
+            len = eol - start;
+            return true;
+         }
+         p = next;
+      }
+      return false;
+   }
+};
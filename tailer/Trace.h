@@ -0,0 +1,82 @@
+#pragma once
+
+// Static tracepoints on the events of the polling loop, written to the ETW TraceLogging provider
+// "Tailer" {BE6EA449-C2D7-456F-80CB-5E15A8621E2A}.  While no trace session has the provider
+// enabled a tracepoint costs a test of the provider's enabled level, and its arguments aren't
+// evaluated; defining TAILER_NO_TRACE compiles them out altogether.  The per-line events are
+// written at the verbose level only, so a session at the information level sees the per-pass
+// and per-file events without the cost of an event per line.  See scripts\tracelag.ps1 for how
+// to record a trace and compute the per-file lag from it.
+
+#ifndef TAILER_NO_TRACE
+
+#include <Windows.h>
+#include <TraceLoggingProvider.h>
+#include <winmeta.h>
+
+TRACELOGGING_DECLARE_PROVIDER(tailerTraceProvider);
+
+#define TRACE_REGISTER() TraceLoggingRegister(tailerTraceProvider)
+#define TRACE_UNREGISTER() TraceLoggingUnregister(tailerTraceProvider)
+
+/** start of a polling pass */
+#define TRACE_POLL_START(pass) \
+   TraceLoggingWrite(tailerTraceProvider, "PollStart", TraceLoggingLevel(WINEVENT_LEVEL_INFO), \
+                     TraceLoggingUInt64(pass, "Pass"))
+
+/** end of a polling pass, with its duration and the number of watched prefixes */
+#define TRACE_POLL_END(pass, micros, files) \
+   TraceLoggingWrite(tailerTraceProvider, "PollEnd", TraceLoggingLevel(WINEVENT_LEVEL_INFO), \
+                     TraceLoggingUInt64(pass, "Pass"), TraceLoggingInt64(micros, "Micros"), TraceLoggingUInt32(files, "Files"))
+
+/** directory rescan after a change notification */
+#define TRACE_RESCAN(files, micros) \
+   TraceLoggingWrite(tailerTraceProvider, "Rescan", TraceLoggingLevel(WINEVENT_LEVEL_INFO), \
+                     TraceLoggingUInt32(files, "Files"), TraceLoggingInt64(micros, "Micros"))
+
+/** a watched file was rotated, renamed, truncated, rewritten or deleted ('kind') */
+#define TRACE_ROTATION(prefix, kind, from, to) \
+   TraceLoggingWrite(tailerTraceProvider, "Rotation", TraceLoggingLevel(WINEVENT_LEVEL_INFO), \
+                     TraceLoggingString((prefix).c_str(), "Prefix"), TraceLoggingString(kind, "Kind"), \
+                     TraceLoggingWideString((from).filename().c_str(), "From"), TraceLoggingWideString((to).filename().c_str(), "To"))
+
+/** the rotated file was drained and tailing switched to its replacement */
+#define TRACE_FILE_SWITCH(prefix, file) \
+   TraceLoggingWrite(tailerTraceProvider, "FileSwitch", TraceLoggingLevel(WINEVENT_LEVEL_INFO), \
+                     TraceLoggingString((prefix).c_str(), "Prefix"), TraceLoggingWideString((file).filename().c_str(), "File"))
+
+/** appended data about to be read; 'writeTime' is the file's last write time (ms since 1970) */
+#define TRACE_FILE_READ(prefix, file, offset, bytes, writeTime) \
+   TraceLoggingWrite(tailerTraceProvider, "FileRead", TraceLoggingLevel(WINEVENT_LEVEL_INFO), \
+                     TraceLoggingString((prefix).c_str(), "Prefix"), TraceLoggingWideString((file).filename().c_str(), "File"), \
+                     TraceLoggingInt64(offset, "Offset"), TraceLoggingInt64(bytes, "Bytes"), TraceLoggingInt64(writeTime, "WriteTime"))
+
+/** a line passed the filters and was handed to the output */
+#define TRACE_LINE(prefix, len) \
+   TraceLoggingWrite(tailerTraceProvider, "Line", TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE), \
+                     TraceLoggingString((prefix).c_str(), "Prefix"), TraceLoggingUInt32((UINT32)(len), "Length"))
+
+/** a line matched the beep pattern */
+#define TRACE_REGEX_MATCH(prefix) \
+   TraceLoggingWrite(tailerTraceProvider, "RegexMatch", TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE), \
+                     TraceLoggingString((prefix).c_str(), "Prefix"))
+
+/** a batch of output was written to stdout */
+#define TRACE_FLUSH(bytes) \
+   TraceLoggingWrite(tailerTraceProvider, "Flush", TraceLoggingLevel(WINEVENT_LEVEL_INFO), TraceLoggingUInt64(bytes, "Bytes"))
+
+#else
+
+#define TRACE_REGISTER()
+#define TRACE_UNREGISTER()
+#define TRACE_POLL_START(pass)
+#define TRACE_POLL_END(pass, micros, files)
+#define TRACE_RESCAN(files, micros)
+#define TRACE_ROTATION(prefix, kind, from, to)
+#define TRACE_FILE_SWITCH(prefix, file)
+#define TRACE_FILE_READ(prefix, file, offset, bytes, writeTime)
+#define TRACE_LINE(prefix, len)
+#define TRACE_REGEX_MATCH(prefix)
+#define TRACE_FLUSH(bytes)
+
+#endif
@@ -9,8 +9,15 @@
 #include <utility>
 #include <set>
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
 #include <regex>
 #include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
 #include <Windows.h>
 #include <conio.h>
 #include <stdlib.h>
@@ -19,6 +26,12 @@
 #include <signal.h>
 #include "Args.h"
 #include "unique_handle.h"
+#include "LogLayout.h"
+#include "LineFilter.h"
+#include "LatencyHistogram.h"
+#include "FileSystem.h"
+#include "SearchPattern.h"
+#include "Trace.h"
 
 namespace fs = std::experimental::filesystem::v1;
 
@@ -26,31 +39,102 @@ namespace fs = std::experimental::filesystem::v1;
 // forward declarations
 //
 class LogFileInfo;
+class OverlappedReader;
+class MergeQueue;
+class RepeatFilter;
 struct GlobalData;
 struct GenericHandlePolicy;
 std::string get_last_error();
 std::string & trim(std::string & str);
 int64_t filetime_to_unix_time(FILETIME &fileTime);
+int64_t local_time_millis();
+int64_t perf_counter();
+uint64_t perf_nanos(int64_t ticks);
 
 ///////////////////////////////////////////////////////////////////////////////
 // typedefs
 //
-typedef std::list<std::shared_ptr<LogFileInfo>> LogFileInfoList;
 typedef std::unordered_map <std::string, std::shared_ptr<LogFileInfo>> PrefixLogFileInfoMap;
 typedef std::shared_ptr<unique_handle<GenericHandlePolicy>> SharedUniqueFileHandlePtr;
 
+SharedUniqueFileHandlePtr open_file_handle(fs::path path, DWORD access = 0, DWORD flags = FILE_ATTRIBUTE_NORMAL);
+
 ///////////////////////////////////////////////////////////////////////////////
 // constants
 //
 
-/** read line max buffer size*/
-const std::streamsize BUFLEN{ 4096 };
+/** size of the per-file buffer that appended data is read into */
+const DWORD READBUF_LEN{ 64 * 1024 };
+
+/** maximum number of completions dequeued from the completion port in one call */
+const ULONG MAX_COMPLETIONS{ 64 };
+
+/** unread ranges at least this large are read as a catch-up (bypassing the cache when requested) */
+const int64_t CATCHUP_THRESHOLD{ 8 * 1024 * 1024 };
+
+/** buffer size for unbuffered catch-up reads -- must be a multiple of the sector size */
+const DWORD UNCACHED_READ_LEN{ 1024 * 1024 };
+
+/** alignment of unbuffered read offsets (covers 512-byte and 4K sector disks) */
+const int64_t SECTOR_ALIGNMENT{ 4096 };
+
+/** appended ranges at least this large are mapped into memory instead of read (when requested) */
+const int64_t MMAP_THRESHOLD{ 4 * 1024 * 1024 };
+
+/** largest view mapped at one time -- bigger ranges are mapped in successive views */
+const int64_t MAP_VIEW_LEN{ 64 * 1024 * 1024 };
+
+/** file offsets of mapped views must be multiples of the allocation granularity */
+const int64_t MAP_ALIGNMENT{ 64 * 1024 };
+
+/** stride used to fault in the pages of a mapped view */
+const size_t PAGE_SIZE{ 4096 };
+
+/** output is written to stdout once this much has been batched (or at the end of the pass) */
+const size_t OUTPUT_BATCH_LEN{ 256 * 1024 };
 
 /** polling interval */
 const DWORD POLLING_INTERVAL_MILLIS{ 750 };
 
+/** longest time a rotated file is drained before switching to its replacement regardless */
+const ULONGLONG ROTATION_GRACE_MILLIS{ 5000 };
+
+/** default time a deleted file's size must stay the same before it is considered drained */
+const unsigned DEFAULT_DRAIN_MILLIS{ 2000 };
+
+/** appended to a partial line printed before its newline arrived */
+const char PARTIAL_MARKER[]{ " ..." };
+
+/** leads the rest of a line whose start was printed as a partial line */
+const char CONTINUATION_MARKER[]{ "... " };
+
+/** a multi-line record is printed once no line has been added to it for this long */
+const ULONGLONG RECORD_FLUSH_MILLIS{ 500 };
+
+/** most lines held for the timestamp merge -- beyond this the earliest are released early */
+const size_t MERGE_MAX_LINES{ 100000 };
+
+/** entries in the table of recently printed lines used to suppress repeats (a power of 2) */
+const size_t REPEAT_TABLE_SIZE{ 4096 };
+
+/** longest part of a repeated line quoted in its "last message repeated" summary */
+const size_t REPEAT_SAMPLE_LEN{ 120 };
+
+/** number of bytes at the start of a file covered by its fingerprint */
+const DWORD FINGERPRINT_LEN{ 4096 };
+
+/** directory entries matched against the file name pattern by each thread of a directory scan */
+const size_t SCAN_NAMES_PER_THREAD{ 4096 };
+
+/** how far --search follows the last line of a range past its end (longer lines are cut there) */
+const int64_t SEARCH_MAX_LINE_LEN{ 1024 * 1024 };
+
+/** bytes read at each probe of the binary search for the --since time */
+const DWORD SEEK_BLOCK_LEN{ 64 * 1024 };
+
 /** signal flags passed from main thread to worker thread  */
 const int DIRECTORY_MODIFIED = 0x1000;
+const int DUMP_STATISTICS    = 0x2000;
 const int STOP_MONITORING    = 0x4000;
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -89,16 +173,373 @@ struct GlobalData {
 // Program options passed to the worker thread.
 struct Options {
    fs::path    logdir;
-   std::regex  filename_regex;
-   std::regex  beep_regex;
+   std::shared_ptr<const std::regex> filename_regex;
+   std::shared_ptr<const std::regex> beep_regex;   // null unless beeping
    bool        beepOnException;
    unsigned    max_files;
-   Options(fs::path &path, std::regex &frx, std::regex &brx, bool beep, unsigned max)
-   : logdir{ path }, filename_regex{ frx }, beep_regex{ brx }, beepOnException{beep}, max_files{max}
+   bool        overlappedIo;
+   bool        bypassCache;
+   bool        mapLargeReads;
+   bool        showPrefix;
+   unsigned    drainMillis;
+   unsigned    partialMillis;
+   unsigned    mergeWindowMillis;   // 0 when lines aren't merged by timestamp
+   LineLayout  layout;
+   unsigned    levelMask;           // levels of the lines that are printed, see level_mask()
+   RecordRule  recordRule;
+   std::shared_ptr<const LineFilter> filter;   // null when every line is printed
+   unsigned    repeatWindowMillis;  // 0 when repeated lines are printed
+   unsigned    statsIntervalMillis; // 0 when statistics are only printed on Ctrl-Break
+   fs::path    statsFile;           // empty when no statistics snapshot is written
+   bool        latency;             // latency histograms are kept
+   int64_t     startTicks;          // perf_counter() when main started, 0 unless startup is timed (--timing)
+   int64_t     patternTicks;        // time taken to compile the patterns
+   bool        seekSince;           // the files found at startup are tailed from the 'since' time (--since)
+   int64_t     since;               // in the terms of TimestampFormat::parse
+   Options(fs::path &path, std::shared_ptr<const std::regex> frx, std::shared_ptr<const std::regex> brx, bool beep, unsigned max, bool overlapped, bool nocache, bool mmap,
+           bool prefix, unsigned drain, unsigned partial, unsigned mergeWindow, LineLayout &lineLayout, unsigned levels,
+           RecordRule records, std::shared_ptr<const LineFilter> lineFilter, unsigned repeatWindow,
+           unsigned statsInterval, fs::path &statsPath, bool latencyHistograms, int64_t started, int64_t patterns,
+           bool seek, int64_t sinceTime)
+   : logdir{ path }, filename_regex{ frx }, beep_regex{ brx }, beepOnException{beep}, max_files{max}, overlappedIo{overlapped},
+     bypassCache{nocache}, mapLargeReads{mmap}, showPrefix{prefix}, drainMillis{drain}, partialMillis{partial},
+     mergeWindowMillis{mergeWindow}, layout{lineLayout}, levelMask{levels}, recordRule{records}, filter{lineFilter}, repeatWindowMillis{repeatWindow},
+     statsIntervalMillis{statsInterval}, statsFile{statsPath}, latency{latencyHistograms},
+     startTicks{started}, patternTicks{patterns}, seekSince{seek}, since{sinceTime}
    {
    }
 };
 
+/**
+ * Batches output lines in one buffer that is written to stdout with a single WriteFile call,
+ * instead of formatting every line through iostreams and flushing it with std::endl.  Each
+ * line is appended as the file's precomputed "prefix: " label followed by the line bytes
+ * taken straight from the read buffer, so the payload is copied once on its way out.
+ * Anything else printed through std::cout must be preceded by a flush() to keep the order.
+ */
+class OutputSink {
+private:
+   HANDLE hOut;
+   std::vector<char> batch;
+   LatencyHistogram *pwriteLatency{nullptr};
+   uint64_t bytesWritten{0};
+
+public:
+   OutputSink() : hOut{GetStdHandle(STD_OUTPUT_HANDLE)} {
+      batch.reserve(OUTPUT_BATCH_LEN);
+   }
+   ~OutputSink() { flush(); }
+
+   bool isConsole() const { return GetFileType(hOut) == FILE_TYPE_CHAR; }
+
+   /** the time taken by every write to stdout is recorded in the histogram */
+   void setWriteLatency(LatencyHistogram *platency) { pwriteLatency = platency; }
+
+   /** bytes written to stdout so far, not counting what is still batched */
+   uint64_t getBytesWritten() const { return bytesWritten; }
+
+   void writeLine(const std::string &label, const char *line, size_t len) {
+      if (!batch.empty() && batch.size() + label.size() + len + 2 > OUTPUT_BATCH_LEN) {
+         flush();
+      }
+      batch.insert(batch.end(), label.begin(), label.end());
+      batch.insert(batch.end(), line, line + len);
+      batch.push_back('\r');
+      batch.push_back('\n');
+   }
+
+   /** writes the lines of a multi-line record, each with the label */
+   void writeRecord(const std::string &label, const char *record, size_t len) {
+      const char *end = record + len;
+      for (;;) {
+         const char *eol = (const char *)memchr(record, '\n', end - record);
+         if (eol == nullptr) {
+            writeLine(label, record, end - record);
+            return;
+         }
+         writeLine(label, record, (eol > record && eol[-1] == '\r') ? eol - record - 1 : eol - record);
+         record = eol + 1;
+      }
+   }
+
+   void flush() {
+      write(batch.data(), batch.size());
+      batch.clear();
+   }
+
+   /** writes 'len' bytes to stdout after anything already batched, returns false if the write fails */
+   bool writeAll(const char *p, size_t len) {
+      if (!batch.empty()) {
+         flush();
+      }
+      return write(p, len);
+   }
+
+private:
+   bool write(const char *p, size_t len) {
+      if (len == 0) {
+         // nothing batched -- not a write to record or trace
+         return true;
+      }
+      TRACE_FLUSH(len);
+      int64_t start = pwriteLatency != nullptr ? perf_counter() : 0;
+      while (len > 0) {
+         DWORD written = 0;
+         if (!WriteFile(hOut, p, (DWORD)std::min<size_t>(len, OUTPUT_BATCH_LEN), &written, NULL) || written == 0) {
+            return false;
+         }
+         p += written;
+         len -= written;
+         bytesWritten += written;
+      }
+      if (pwriteLatency != nullptr) {
+         pwriteLatency->record(perf_nanos(perf_counter() - start));
+      }
+      return true;
+   }
+};
+
+/**
+ * Timestamp-ordered k-way merge of the lines from all of the watched files.  Lines are held in a
+ * min-heap ordered by their leading timestamp until the reordering window has passed since they
+ * were read, so lines from different files come out in the order they were logged while the
+ * added latency stays bounded.  When more than MERGE_MAX_LINES lines are held the earliest are
+ * released straight away, which caps the memory used.
+ */
+class MergeQueue {
+private:
+   struct Entry {
+      int64_t timestamp;
+      uint64_t seq;           // keeps lines with the same timestamp in the order they were read
+      ULONGLONG due;          // tick count when the line must be released
+      std::string label;
+      std::string text;
+   };
+   struct Later {
+      bool operator()(const Entry &a, const Entry &b) const {
+         return a.timestamp != b.timestamp ? a.timestamp > b.timestamp : a.seq > b.seq;
+      }
+   };
+   std::vector<Entry> heap;
+   TimestampFormat format;
+   Clock &clock;
+   ULONGLONG window;
+   uint64_t seq{0};
+
+   void releaseFirst(OutputSink &sink) {
+      std::pop_heap(heap.begin(), heap.end(), Later());
+      Entry &entry = heap.back();
+      sink.writeRecord(entry.label, entry.text.data(), entry.text.size());
+      heap.pop_back();
+   }
+
+public:
+   MergeQueue(const TimestampFormat &fmt, Clock &c, ULONGLONG windowMillis) : format{fmt}, clock{c}, window{windowMillis} {}
+
+   const TimestampFormat &getFormat() const { return format; }
+
+   void push(int64_t timestamp, const std::string &label, const char *line, size_t len, OutputSink &sink) {
+      heap.push_back(Entry{timestamp, seq++, clock.tickCount() + window, label, std::string(line, len)});
+      std::push_heap(heap.begin(), heap.end(), Later());
+      if (heap.size() > MERGE_MAX_LINES) {
+         releaseFirst(sink);
+      }
+   }
+
+   /** writes the lines that are due, in timestamp order, to the sink ('all' releases everything) */
+   void release(OutputSink &sink, bool all) {
+      ULONGLONG now = clock.tickCount();
+      while (!heap.empty() && (all || heap.front().due <= now)) {
+         releaseFirst(sink);
+      }
+   }
+
+   /** milliseconds until the earliest line is due, or 'limit' if that is sooner */
+   DWORD millisUntilDue(DWORD limit) const {
+      if (heap.empty()) {
+         return limit;
+      }
+      ULONGLONG now = clock.tickCount();
+      ULONGLONG due = heap.front().due;
+      return due <= now ? 0 : (DWORD)std::min<ULONGLONG>(due - now, limit);
+   }
+};
+
+/**
+ * Suppresses lines that repeat a line printed less than the window ago, e.g. the same error
+ * logged thousands of times a second by a failing subsystem.  Lines are compared by a hash of
+ * their prefix and text with every run of digits masked, so lines that only differ in their
+ * timestamp, counters or ids count as repeats.  When the window of a repeated line is over
+ * (or its slot is needed for another line) a "last message repeated N times" summary is printed
+ * and the next repeat is printed again.  The hashes are kept in a fixed-size direct-mapped
+ * table, so the memory used is bounded however many different lines are logged.
+ */
+class RepeatFilter {
+private:
+   struct Entry {
+      uint64_t hash{0};       // 0 when the slot is free
+      ULONGLONG printed{0};   // tick count when the line was printed
+      unsigned repeats{0};
+      int64_t timestamp{0};   // timestamp the summary is merged with
+      std::string label;      // copied when the first repeat is suppressed
+      std::string sample;
+   };
+   std::vector<Entry> table;
+   Clock &clock;
+   ULONGLONG window;
+
+   static uint64_t normalizedHash(const std::string &prefix, const char *line, size_t len) {
+      uint64_t hash = 0xcbf29ce484222325ULL;
+      for (char ch : prefix) {
+         hash = (hash ^ (unsigned char)ch) * 0x100000001b3ULL;
+      }
+      hash = (hash ^ '\n') * 0x100000001b3ULL;
+      bool digits = false;
+      for (size_t i = 0; i < len; i++) {
+         unsigned char ch = (unsigned char)line[i];
+         if (ch >= '0' && ch <= '9') {
+            if (digits) {
+               continue;
+            }
+            digits = true;
+            ch = '#';
+         } else {
+            digits = false;
+         }
+         hash = (hash ^ ch) * 0x100000001b3ULL;
+      }
+      return hash != 0 ? hash : 1;
+   }
+
+   void report(Entry &entry, OutputSink &sink, MergeQueue *pmerge);
+
+public:
+   RepeatFilter(Clock &c, ULONGLONG windowMillis) : table(REPEAT_TABLE_SIZE), clock{c}, window{windowMillis} {}
+
+   /**
+    * Returns true if the line is a repeat that mustn't be printed.  'label' and 'timestamp' are
+    * used for the summary printed once the repeats are over.
+    */
+   bool suppress(const std::string &prefix, const std::string &label, const char *line, size_t len, int64_t timestamp,
+                 OutputSink &sink, MergeQueue *pmerge) {
+      uint64_t hash = normalizedHash(prefix, line, len);
+      Entry &entry = table[hash & (table.size() - 1)];
+      ULONGLONG now = clock.tickCount();
+      if (entry.hash == hash && now - entry.printed < window) {
+         if (entry.repeats++ == 0) {
+            entry.label = label;
+            entry.sample.assign(line, std::min(len, REPEAT_SAMPLE_LEN));
+         }
+         entry.timestamp = timestamp;
+         return true;
+      }
+      report(entry, sink, pmerge);
+      entry.hash = hash;
+      entry.printed = now;
+      return false;
+   }
+
+   /** prints the summaries of the repeated lines whose window is over ('all' prints every summary) */
+   void reportExpired(OutputSink &sink, MergeQueue *pmerge, bool all) {
+      ULONGLONG now = clock.tickCount();
+      for (Entry &entry : table) {
+         if (entry.hash != 0 && (all || now - entry.printed >= window)) {
+            report(entry, sink, pmerge);
+         }
+      }
+   }
+};
+
+void RepeatFilter::report(Entry &entry, OutputSink &sink, MergeQueue *pmerge) {
+   if (entry.repeats > 0) {
+      std::string text = "last message repeated " + std::to_string(entry.repeats) + " times: " + entry.sample;
+      if (entry.sample.size() == REPEAT_SAMPLE_LEN) {
+         text += PARTIAL_MARKER;
+      }
+      if (pmerge != nullptr) {
+         pmerge->push(entry.timestamp, entry.label, text.data(), text.size(), sink);
+      } else {
+         sink.writeLine(entry.label, text.data(), text.size());
+      }
+   }
+   entry.hash = 0;
+   entry.repeats = 0;
+}
+
+/**
+ * Counters and timings of the worker thread, reported on Ctrl-Break and every --stats-interval.
+ * Only the worker thread updates and reads them, so they are plain integers -- counting costs an
+ * add and timing a pass a QueryPerformanceCounter call, without locks or atomic operations.
+ */
+struct Statistics {
+   ULONGLONG started{0};            // tick count, set when the worker starts
+   uint64_t linesRead{0};           // lines (or records) split from the files
+   uint64_t linesPrinted{0};        // lines that weren't filtered out or suppressed as repeats
+   uint64_t bytesRead{0};
+   uint64_t passes{0};              // calls of tailAllFiles
+   int64_t passLast{0};             // QueryPerformanceCounter ticks
+   int64_t passMax{0};
+   int64_t passTotal{0};
+   uint64_t scans{0};               // directory scans (collectLogFiles)
+   int64_t scanLast{0};
+   int64_t scanMax{0};
+   int64_t scanTotal{0};
+   // counts when the statistics were last reported, for the rates since then
+   ULONGLONG reported{0};
+   uint64_t reportedLinesRead{0};
+   uint64_t reportedLinesPrinted{0};
+   uint64_t reportedBytesRead{0};
+   // latency histograms in nanoseconds, only filled in with --latency
+   bool latency{false};
+   LatencyHistogram detectLatency;  // last write time of the file to its lines being written to stdout
+   LatencyHistogram readLatency;    // start of a read to its data being split into lines
+   LatencyHistogram matchLatency;   // level, filter, repeat and beep checks of a line
+   LatencyHistogram formatLatency;  // labeling and batching (or merging) of a line
+   LatencyHistogram writeLatency;   // writing a batch to stdout
+
+   static int64_t micros(int64_t ticks) { return (int64_t)perf_nanos(ticks) / 1000; }
+
+   void addPass(int64_t ticks) {
+      passes++;
+      passLast = ticks;
+      passMax = std::max(passMax, ticks);
+      passTotal += ticks;
+   }
+
+   void addScan(int64_t ticks) {
+      scans++;
+      scanLast = ticks;
+      scanMax = std::max(scanMax, ticks);
+      scanTotal += ticks;
+   }
+};
+
+/**
+ * Worker thread settings used on each polling pass by tailAllFiles and the functions it calls.
+ */
+struct TailContext {
+   OutputSink        sink;
+   Clock             *pclock{nullptr};
+   FileSystem        *pfs{nullptr};
+   const std::regex  *pbeep_regex{nullptr};
+   OverlappedReader  *preader{nullptr};       // null when reading synchronously
+   bool              bypassCache{false};      // catch-up reads don't go through the file system cache
+   bool              mapLargeReads{false};    // large appended ranges are split directly from a mapped view
+   bool              showPrefix{true};        // lines are labeled with the prefix of their file
+   bool              rawPassthrough{false};   // appended data is copied to stdout as-is, see passThrough()
+   ULONGLONG         drainMillis{DEFAULT_DRAIN_MILLIS};  // a deleted file is released once its size is stable this long
+   ULONGLONG         partialMillis{0};        // an unterminated last line unchanged this long is printed (0 = never)
+   MergeQueue        *pmerge{nullptr};        // null unless lines are merged by timestamp
+   const LineLayout  *playout{nullptr};       // layout of the lines in the log files
+   unsigned          levelMask{ALL_LEVELS};   // lines with other levels are dropped before they are printed
+   RecordRule        recordRule{RecordRule::None};  // continuation lines are printed with the line they continue
+   const LineFilter  *pfilter{nullptr};       // null unless lines are selected by --filter, --include or --exclude
+   RepeatFilter      *prepeats{nullptr};      // null unless repeated lines are suppressed
+   Statistics        stats;
+   int64_t           readStarted{0};          // perf_counter() when the read being split was started
+   int64_t           startTicks{0};           // perf_counter() when main started until the first line is printed (--timing)
+};
+
 /**
   Policy object for unique_handle when dealing with generic handle returned from
   CreateFile or any other call that uses the CloseHandle call to dispose.
@@ -115,16 +556,293 @@ struct GenericHandlePolicy {
 };
 
 /**
- * Information about a file being monitored: the path, date, file size, last-tailed position
+  Policy object for unique_handle when dealing with a search handle returned from FindFirstFileEx.
+*/
+struct FindHandlePolicy {
+   typedef HANDLE handle_type;
+   static void close(handle_type handle) {
+      if (handle != INVALID_HANDLE_VALUE) {
+         FindClose(handle);
+      }
+   }
+   static handle_type get_null() { return INVALID_HANDLE_VALUE; }
+   static bool is_null(handle_type handle) {  return handle == INVALID_HANDLE_VALUE; }
+};
+
+/**
+  Policy object for unique_handle when dealing with memory returned from VirtualAlloc.
+*/
+struct VirtualMemoryPolicy {
+   typedef LPVOID handle_type;
+   static void close(handle_type handle) {
+      VirtualFree(handle, 0, MEM_RELEASE);
+   }
+   static handle_type get_null() { return NULL; }
+   static bool is_null(handle_type handle) {  return handle == NULL; }
+};
+
+/**
+  Policy object for unique_handle when dealing with a view returned from MapViewOfFile.
+*/
+struct MappedViewPolicy {
+   typedef LPVOID handle_type;
+   static void close(handle_type handle) {
+      UnmapViewOfFile(handle);
+   }
+   static handle_type get_null() { return NULL; }
+   static bool is_null(handle_type handle) {  return handle == NULL; }
+};
+
+/** GetTickCount64 and the system time */
+class SystemClock : public Clock {
+public:
+   ULONGLONG tickCount() override { return GetTickCount64(); }
+   int64_t currentTime() override {
+      FILETIME now;
+      GetSystemTimeAsFileTime(&now);
+      return filetime_to_unix_time(now);
+   }
+};
+
+/** file opened with CreateFile */
+class SystemOpenFile : public OpenFile {
+private:
+   SharedUniqueFileHandlePtr handle;
+   bool overlapped_io;                       // handle was opened for overlapped I/O
+
+public:
+   SystemOpenFile(SharedUniqueFileHandlePtr h, bool overlappedIo) : handle{h}, overlapped_io{overlappedIo} {}
+
+   bool query(FileStatus &status) override {
+      BY_HANDLE_FILE_INFORMATION fileInfo;
+      if (!GetFileInformationByHandle(handle->get(), &fileInfo)) {
+         return false;
+      }
+      status.identity.volume = fileInfo.dwVolumeSerialNumber;
+      status.identity.index = ((uint64_t)fileInfo.nFileIndexHigh << 32) | fileInfo.nFileIndexLow;
+      LARGE_INTEGER lint;
+      lint.HighPart = fileInfo.nFileSizeHigh;
+      lint.LowPart = fileInfo.nFileSizeLow;
+      status.size = lint.QuadPart;
+      status.createTime = filetime_to_unix_time(fileInfo.ftCreationTime);
+      status.writeTime = filetime_to_unix_time(fileInfo.ftLastWriteTime);
+      return true;
+   }
+
+   /** also waits for the read when the handle is overlapped */
+   bool readAt(int64_t pos, char *buf, DWORD len, DWORD &bytesRead) override {
+      OVERLAPPED ov{};
+      ov.Offset = (DWORD)pos;
+      ov.OffsetHigh = (DWORD)(pos >> 32);
+      unique_handle<GenericHandlePolicy> event;
+      if (overlapped_io) {
+         event.reset(CreateEvent(NULL, TRUE, FALSE, NULL));
+         if (!event) {
+            return false;
+         }
+         // setting the low-order bit keeps the completion off the overlapped engine's port
+         ov.hEvent = (HANDLE)((ULONG_PTR)event.get() | 1);
+      }
+      BOOL ok = ReadFile(handle->get(), buf, len, &bytesRead, &ov);
+      if (!ok && GetLastError() == ERROR_IO_PENDING) {
+         ok = GetOverlappedResult(handle->get(), &ov, &bytesRead, TRUE);
+      }
+      return ok ? true : false;
+   }
+
+   /**
+    * A writer that had the file open before it was deleted can go on appending to it and our
+    * handle can still read it, just not by name.
+    */
+   bool isDeletedButOpen() override {
+      FILE_STANDARD_INFO standardInfo;
+      if (GetFileInformationByHandleEx(handle->get(), FileStandardInfo, &standardInfo, sizeof(standardInfo))) {
+         return standardInfo.DeletePending || standardInfo.NumberOfLinks == 0;
+      }
+      return false;
+   }
+
+   HANDLE getHandle() override { return handle->get(); }
+};
+
+/** the Win32 file system */
+class SystemFileSystem : public FileSystem {
+public:
+   /**
+    * The times and size come with the directory entries, so listing a directory with many files
+    * doesn't cost a query per file.
+    */
+   void listFiles(const fs::path &dir, std::vector<FileEntry> &files) override {
+      WIN32_FIND_DATA data;
+      unique_handle<FindHandlePolicy> find(FindFirstFileEx((dir / "*").c_str(), FindExInfoBasic, &data, FindExSearchNameMatch,
+                                                           NULL, FIND_FIRST_EX_LARGE_FETCH));
+      for (bool more = (bool)find; more; more = FindNextFile(find.get(), &data) != FALSE) {
+         if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0) {
+            FileEntry entry{dir / data.cFileName};
+            entry.status.createTime = filetime_to_unix_time(data.ftCreationTime);
+            entry.status.writeTime = filetime_to_unix_time(data.ftLastWriteTime);
+            LARGE_INTEGER lint;
+            lint.HighPart = data.nFileSizeHigh;
+            lint.LowPart = data.nFileSizeLow;
+            entry.status.size = lint.QuadPart;
+            files.push_back(entry);
+         }
+      }
+   }
+
+   bool getStatus(const fs::path &path, FileStatus &status) override {
+      WIN32_FILE_ATTRIBUTE_DATA fileData;
+      if (!GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &fileData)) {
+         return false;
+      }
+      status.createTime = filetime_to_unix_time(fileData.ftCreationTime);
+      status.writeTime = filetime_to_unix_time(fileData.ftLastWriteTime);
+      LARGE_INTEGER lint;
+      lint.HighPart = fileData.nFileSizeHigh;
+      lint.LowPart = fileData.nFileSizeLow;
+      status.size = lint.QuadPart;
+      return true;
+   }
+
+   FileIdentity getIdentity(const fs::path &path) override {
+      // opened without any access rights, which is enough to query the file information
+      FileStatus status;
+      SharedUniqueFileHandlePtr hPtr = open_file_handle(path);
+      if (hPtr && SystemOpenFile(hPtr, false).query(status)) {
+         return status.identity;
+      }
+      return FileIdentity{};
+   }
+
+   std::shared_ptr<OpenFile> open(const fs::path &path, bool overlapped) override {
+      SharedUniqueFileHandlePtr handle = open_file_handle(path, GENERIC_READ, overlapped ? FILE_FLAG_OVERLAPPED : FILE_FLAG_SEQUENTIAL_SCAN);
+      return handle ? std::make_shared<SystemOpenFile>(handle, overlapped) : nullptr;
+   }
+};
+
+/**
+ * Finds the first line that starts in [from, limit) with a timestamp at or after 'minTimestamp'.
+ * Unless 'from' is 0 the search resyncs to the start of the next line (a line starting right at
+ * 'from' counts); lines without a timestamp, e.g. stack traces, are skipped.  Reads the file a
+ * block at a time into 'buf' (SEEK_BLOCK_LEN bytes), and only the start of a line longer than a
+ * block is checked.  Returns false if there is no such line.
+ */
+bool findDatedLine(OpenFile &file, int64_t from, int64_t limit, const TimestampFormat &format, int64_t minTimestamp,
+                   char *buf, int64_t &start, int64_t &timestamp) {
+   int64_t pos = from > 0 ? from - 1 : 0;
+   bool atLineStart = from == 0;
+   while (pos < limit) {
+      DWORD bytesRead = 0;
+      if (!file.readAt(pos, buf, SEEK_BLOCK_LEN, bytesRead) || bytesRead == 0) {
+         return false;
+      }
+      const char *p = buf;
+      const char *end = buf + bytesRead;
+      if (!atLineStart) {
+         const char *eol = (const char *)memchr(p, '\n', bytesRead);
+         if (eol == nullptr) {
+            pos += bytesRead;
+            continue;
+         }
+         p = eol + 1;
+         atLineStart = true;
+      }
+      while (p < end && pos + (p - buf) < limit) {
+         const char *eol = (const char *)memchr(p, '\n', end - p);
+         if (eol == nullptr && p > buf && bytesRead == SEEK_BLOCK_LEN) {
+            break;   // read the rest of the line from its start
+         }
+         if (format.parse(p, (eol != nullptr ? eol : end) - p, timestamp) && timestamp >= minTimestamp) {
+            start = pos + (p - buf);
+            return true;
+         }
+         if (eol == nullptr) {
+            atLineStart = false;
+            p = end;
+            break;
+         }
+         p = eol + 1;
+      }
+      if (p < end && pos + (p - buf) >= limit) {
+         return false;
+      }
+      pos += p - buf;
+   }
+   return false;
+}
+
+/**
+ * Offset of the first line of the file with a timestamp at or after 'since', or 'size' if there is
+ * none.  Log lines are written in time order, so this is a binary search on byte offsets that
+ * probes the first dated line after the middle of the range left, with one block read per probe,
+ * until the range fits in a block.
+ */
+int64_t seekTimestamp(OpenFile &file, int64_t size, const TimestampFormat &format, int64_t since) {
+   std::unique_ptr<char[]> buf(new char[SEEK_BLOCK_LEN]);
+   // the line looked for starts in [lo, hi), or at 'found' if no line in the range qualifies
+   int64_t lo = 0;
+   int64_t hi = size;
+   int64_t found = size;
+   int64_t start;
+   int64_t timestamp;
+   while (hi - lo > (int64_t)SEEK_BLOCK_LEN) {
+      int64_t mid = lo + (hi - lo) / 2;
+      if (!findDatedLine(file, mid, hi, format, INT64_MIN, buf.get(), start, timestamp)) {
+         hi = mid;
+      } else if (timestamp >= since) {
+         found = start;
+         hi = mid;
+      } else {
+         lo = start + 1;
+      }
+   }
+   return findDatedLine(file, lo, hi, format, since, buf.get(), start, timestamp) ? start : found;
+}
+
+/**
+ * Information about a file being monitored: the path, date, file size, last-tailed position.
+ * While the file is watched it is kept open so each polling pass costs a single query of the
+ * open file (GetFileInformationByHandle) instead of an open/query/close sequence.
  */
 class LogFileInfo {
 private:
    std::string prefix{ "" };
+   std::string label{ "" };                  // "prefix: " written in front of every line
    fs::path path{ "" };
+   FileSystem *pfs{nullptr};
+   Clock *pclock{nullptr};
    int64_t create_time{0};
    int64_t write_time{0};
    int64_t file_size{0};
    int64_t last_tailed_pos{0};
+   int64_t read_target{0};                   // file size the current overlapped read is working towards
+   std::shared_ptr<OpenFile> file;           // open while the file is being watched
+   std::unique_ptr<char[]> read_buffer;      // allocated when the handle is opened, reused for every read
+   OVERLAPPED overlapped{};                  // used by the overlapped I/O engine
+   std::string partial_line;                 // bytes read after the last newline
+   size_t partial_printed{0};                // bytes of the partial line already printed before its newline
+   ULONGLONG partial_changed{0};             // tick count when the partial line last changed
+   int64_t last_timestamp{0};                // timestamp of the last line that had one (timestamp merge)
+   std::shared_ptr<LogFileInfo> predecessor; // rotated file that is drained before this one is tailed
+   ULONGLONG drain_deadline{0};              // tick count when draining this file is abandoned
+   bool unlinked{false};                     // deleted while open -- drained until the writer stops
+   ULONGLONG last_change{0};                 // tick count when the file size last changed
+   FileIdentity identity;                    // filled in the first time the file is opened
+   uint64_t fingerprint{0};                  // hash of the first fingerprint_len bytes of the file
+   DWORD fingerprint_len{0};
+   bool level_dropping{false};               // the last line with a level had a level not printed -- continuation lines follow it
+   bool filter_dropping{false};              // the last line the filter could judge didn't match -- continuation lines follow it
+   std::string pending_record;               // multi-line record that may get more lines in the next block
+   int64_t read_started{0};                  // perf_counter() when the current overlapped read was issued
+   int64_t pending_write_time{0};            // last write time of data read but not yet written to stdout (--latency)
+   ULONGLONG record_changed{0};              // tick count when the pending record last changed
+
+   static uint64_t fnv1a(uint64_t hash, const char *data, size_t len) {
+      for (size_t i = 0; i < len; i++) {
+         hash = (hash ^ (unsigned char)data[i]) * 0x100000001b3ULL;
+      }
+      return hash;
+   }
 
 public:
    LogFileInfo() {
@@ -132,7 +850,10 @@ public:
 
    LogFileInfo(const LogFileInfo &other) :
          prefix{other.getPrefix()},
+         label{other.getLabel()},
          path{other.getPath()},
+         pfs{other.pfs},
+         pclock{other.pclock},
          create_time{other.getCreateTime() },
          write_time{other.getWriteTime()},
          file_size{ other.getFileSize() },
@@ -140,30 +861,34 @@ public:
    {
    }
 
-   LogFileInfo(std::string prefixStr, fs::path filePath) :
+   LogFileInfo(std::string prefixStr, fs::path filePath, FileSystem &fileSystem, Clock &clock) :
          prefix(prefixStr),
-         path(filePath)
+         label(prefixStr + ": "),
+         path(filePath),
+         pfs(&fileSystem),
+         pclock(&clock)
    {
-      LPCWSTR pathStr = filePath.c_str();
-      WIN32_FILE_ATTRIBUTE_DATA fileData;
-      if (GetFileAttributesEx(pathStr, GetFileExInfoStandard, &fileData)) {
-         create_time = filetime_to_unix_time(fileData.ftCreationTime);
-         write_time = filetime_to_unix_time(fileData.ftLastWriteTime);
-         LARGE_INTEGER lint;
-         lint.HighPart = fileData.nFileSizeHigh;
-         lint.LowPart = fileData.nFileSizeLow;
-         file_size = lint.QuadPart;
-         last_tailed_pos = lint.QuadPart;
+      FileStatus status;
+      if (fileSystem.getStatus(filePath, status)) {
+         create_time = status.createTime;
+         write_time = status.writeTime;
+         file_size = status.size;
+         last_tailed_pos = status.size;
       }
    }
 
-   void startWatching() {
+   void startWatching(bool fromStart = false) {
       // if it's a new file it might already have data in it by the time we first see it,
       // but we want to start tailing from the start
       std::string rewind_message;
-      if (file_size > 0 && file_size < 1000 ) {
-         std::time_t now = std::time(nullptr);
-         std::time_t create = getCreateTime()/1000;  // create time is milliseconds, not seconds
+      if (fromStart) {
+         // replacement for a rotated file -- everything written to it is new
+         setFileSize(0);
+         setLastTailedPosition(0);
+         rewind_message = " (from start of file)";
+      } else if (file_size > 0 && file_size < 1000 ) {
+         int64_t now = pclock->currentTime() / 1000;
+         int64_t create = getCreateTime()/1000;  // create time is milliseconds, not seconds
          if ((now - create) < 6) {
             setLastTailedPosition(0);
             rewind_message = " (rewinding to start of file)";
@@ -171,16 +896,135 @@ public:
       }
       std::cout << "********* " << prefix << ": WATCHING " << path.filename() << rewind_message << std::endl;
    }
+
+   /** starts watching from the first line with a timestamp at or after 'since' (--since) */
+   void startWatchingSince(int64_t since, const TimestampFormat &format) {
+      std::shared_ptr<OpenFile> seekFile = pfs->open(path, false);
+      int64_t pos = seekFile ? seekTimestamp(*seekFile, file_size, format, since) : file_size;
+      // the lines from there on count as appended, so they are printed on the first pass
+      setFileSize(pos);
+      setLastTailedPosition(pos);
+      std::cout << "********* " << prefix << ": WATCHING " << path.filename() << " (from offset " << pos << ")" << std::endl;
+   }
    void stopWatching() {
       std::cout << "********* STOPPING " << path.filename() << std::endl;
+      closeHandle();
+      if (predecessor) {
+         predecessor->stopWatching();
+         predecessor.reset();
+      }
+   }
+
+   bool openHandle(bool overlappedIo) {
+      if (!file) {
+         file = pfs->open(path, overlappedIo);
+         if (file && !read_buffer) {
+            read_buffer.reset(new char[READBUF_LEN]);
+         }
+         if (file && fingerprint_len == 0) {
+            checkFingerprint(file_size);
+         }
+      }
+      return isOpen();
+   }
+   void closeHandle() {
+      file.reset();
+   }
+   bool isOpen() const { return file ? true : false; }
+   HANDLE getHandle() const { return file ? file->getHandle() : NULL; }
+
+   bool queryFileInfo(int64_t &size, int64_t &writeTime) {
+      FileStatus status;
+      if (file && file->query(status)) {
+         identity = status.identity;
+         size = status.size;
+         writeTime = status.writeTime;
+         return true;
+      }
+      return false;
+   }
+
+   /** identity of the file, from the open file or (if not watched yet) from the path */
+   FileIdentity getIdentity() {
+      if (!identity.isValid()) {
+         FileStatus status;
+         if (file && file->query(status)) {
+            identity = status.identity;
+         } else if (!file) {
+            identity = pfs->getIdentity(path);
+         }
+      }
+      return identity;
+   }
+
+   /** true if the file was deleted but is still open */
+   bool isDeletedButOpen() const {
+      return file && file->isDeletedButOpen();
+   }
+
+   /** synchronous positional read */
+   bool readAt(int64_t pos, char *buf, DWORD len, DWORD &bytesRead) {
+      return file->readAt(pos, buf, len, bytesRead);
+   }
+
+   /** synchronous positional read of up to 'len' bytes at 'pos' into the read buffer */
+   bool read(int64_t pos, int64_t len, DWORD &bytesRead) {
+      return readAt(pos, read_buffer.get(), (DWORD)std::min<int64_t>(len, READBUF_LEN), bytesRead);
+   }
+
+   /**
+    * Checks that the start of the file still holds the data it had when the fingerprint was
+    * taken.  If it doesn't, the file was truncated and rewritten (copytruncate) or replaced in
+    * place between two polls even though it didn't get smaller.  The fingerprint grows with the
+    * file up to FINGERPRINT_LEN bytes, all in the same single read.  A failed read counts as a
+    * match so an I/O error never causes the file to be re-read from the start.
+    */
+   bool checkFingerprint(int64_t size) {
+      char head[FINGERPRINT_LEN];
+      DWORD len = (DWORD)std::min<int64_t>(size, FINGERPRINT_LEN);
+      DWORD bytesRead = 0;
+      if (len == 0 || len < fingerprint_len || !readAt(0, head, len, bytesRead) || bytesRead < fingerprint_len) {
+         return true;
+      }
+      uint64_t hash = fnv1a(0xcbf29ce484222325ULL, head, fingerprint_len);
+      bool matched = (fingerprint_len == 0 || hash == fingerprint);
+      fingerprint = fnv1a(hash, head + fingerprint_len, bytesRead - fingerprint_len);
+      fingerprint_len = bytesRead;
+      return matched;
    }
 
-   std::string getPrefix() const { return prefix; }
+   void resetFingerprint() {
+      fingerprint = 0;
+      fingerprint_len = 0;
+   }
+
+   const std::string &getPrefix() const { return prefix; }
+   const std::string &getLabel() const { return label; }
    fs::path getPath() const { return path; }
    int64_t getCreateTime() const { return create_time; }
    int64_t getWriteTime() const { return write_time; }
    int64_t getFileSize() const { return file_size; }
    int64_t getLastTailedPosition() const { return last_tailed_pos; }
+   int64_t getReadTarget() const { return read_target; }
+   char *getReadBuffer() { return read_buffer.get(); }
+   OVERLAPPED *getOverlapped() { return &overlapped; }
+   std::string &getPartialLine() { return partial_line; }
+   size_t getPartialPrinted() const { return partial_printed; }
+   ULONGLONG getPartialChanged() const { return partial_changed; }
+   int64_t getLastTimestamp() const { return last_timestamp; }
+   std::shared_ptr<LogFileInfo> getPredecessor() const { return predecessor; }
+   ULONGLONG getDrainDeadline() const { return drain_deadline; }
+   bool isUnlinked() const { return unlinked; }
+   ULONGLONG getLastChange() const { return last_change; }
+   bool isLevelDropping() const { return level_dropping; }
+   bool isFilterDropping() const { return filter_dropping; }
+   std::string &getPendingRecord() { return pending_record; }
+   ULONGLONG getRecordChanged() const { return record_changed; }
+   int64_t getReadStarted() const { return read_started; }
+   int64_t getPendingWriteTime() const { return pending_write_time; }
+   void setPath(const fs::path &newPath) {
+      path = newPath;
+   }
    void setWriteTime(int64_t wt) {
       write_time = wt;
    }
@@ -190,6 +1034,49 @@ public:
    void setLastTailedPosition(int64_t pos) {
       last_tailed_pos = pos;
    }
+   void setReadTarget(int64_t target) {
+      read_target = target;
+   }
+   void setPredecessor(std::shared_ptr<LogFileInfo> prev) {
+      predecessor = prev;
+   }
+   void setDrainDeadline(ULONGLONG deadline) {
+      drain_deadline = deadline;
+   }
+   void setPartialPrinted(size_t len) {
+      partial_printed = len;
+   }
+   void setPartialChanged(ULONGLONG tick) {
+      partial_changed = tick;
+   }
+   void setLastTimestamp(int64_t timestamp) {
+      last_timestamp = timestamp;
+   }
+   void clearPartialLine() {
+      partial_line.clear();
+      partial_printed = 0;
+   }
+   void setUnlinked(bool deleted) {
+      unlinked = deleted;
+   }
+   void setLastChange(ULONGLONG tick) {
+      last_change = tick;
+   }
+   void setLevelDropping(bool drop) {
+      level_dropping = drop;
+   }
+   void setFilterDropping(bool drop) {
+      filter_dropping = drop;
+   }
+   void setRecordChanged(ULONGLONG tick) {
+      record_changed = tick;
+   }
+   void setReadStarted(int64_t counter) {
+      read_started = counter;
+   }
+   void setPendingWriteTime(int64_t wt) {
+      pending_write_time = wt;
+   }
 };
 
 /**
@@ -204,6 +1091,28 @@ private:
    args::ValueFlag<std::string> line_beep_pattern;
    args::Flag nobeep;
    args::ValueFlag<int> max_files;
+   args::Flag overlapped;
+   args::Flag nocache;
+   args::Flag mmap;
+   args::Flag noprefix;
+   args::ValueFlag<int> drain_millis;
+   args::ValueFlag<int> partial_millis;
+   args::ValueFlag<int> merge_window;
+   args::ValueFlag<std::string> timestamp_format;
+   args::ValueFlag<std::string> line_layout;
+   args::ValueFlag<std::string> min_level;
+   args::ValueFlag<std::string> levels;
+   args::ValueFlag<std::string> records;
+   args::ValueFlag<std::string> filter;
+   args::ValueFlagList<std::string> includes;
+   args::ValueFlagList<std::string> excludes;
+   args::ValueFlag<int> dedup_millis;
+   args::ValueFlag<int> stats_interval;
+   args::ValueFlag<std::string> stats_file;
+   args::Flag latency;
+   args::Flag timing;
+   args::ValueFlag<std::string> search;
+   args::ValueFlag<std::string> since;
    int stat{0};
 
 public:
@@ -215,7 +1124,29 @@ public:
                       {'p', "pattern"}),
          line_beep_pattern(parser, "pattern", "Regex that triggers a beep when an output line matches.", {'b', "beep"}),
          nobeep(parser, "nobeep", "Disable checking for the 'beep' regular expression.", {'n', "nobeep"}),
-         max_files(parser, "max_files", "Maximum number of files to match", {'m', "max"})
+         max_files(parser, "max_files", "Maximum number of files to match", {'m', "max"}),
+         overlapped(parser, "overlapped", "Read all of the watched files with overlapped I/O, issuing the reads for every file that grew in one batch on each polling pass.", {'o', "overlapped"}),
+         nocache(parser, "nocache", "Bypass the file system cache when catching up on a large amount of unread data so it doesn't evict pages other applications need.", {'c', "nocache"}),
+         mmap(parser, "mmap", "Map large appended ranges into memory and split the lines directly from the mapped view instead of reading them into a buffer.  Only used for a directory on a local fixed drive; a disk error while a view is split still ends tailer.", {"mmap"}),
+         noprefix(parser, "noprefix", "Print lines without the 'prefix: ' label.  When beeping is also disabled and the output is redirected, appended data is copied to the output without being split into lines.", {"noprefix"}),
+         drain_millis(parser, "millis", "How long a file that was deleted while still being written must stop growing before it is released (defaults to 2000).", {'d', "drain"}),
+         partial_millis(parser, "millis", "Print a last line that has no newline yet once it has been unchanged for this long, e.g. progress messages and prompts.  The rest of the line is printed when it arrives.", {'t', "partial"}),
+         merge_window(parser, "millis", "Merge the lines from all files in timestamp order, holding each line for up to this long so later lines with earlier timestamps can be printed first.", {"merge"}),
+         timestamp_format(parser, "format", "Format of the timestamp at the start of each line used by --merge: %Y %m %d %H %M %S and %f (milliseconds), other characters match literally (defaults to '%Y-%m-%d %H:%M:%S,%f').", {"timestamp"}),
+         line_layout(parser, "layout", "Layout of the log lines: %T timestamp, %L level, %t thread name and %m message, other characters match literally (defaults to '%T %L [%t] - %m').", {"layout"}),
+         min_level(parser, "level", "Print only the lines with this level or a more severe one (trace, debug, info, warn, error or fatal).  Lines without a level, e.g. stack traces, follow the line before them.", {"min-level"}),
+         levels(parser, "levels", "Print only the lines with one of these comma separated levels, e.g. 'debug,error'.", {"levels"}),
+         records(parser, "rule", "Print multi-line records such as stack traces as a whole, recognizing the lines that continue a record by: 'indent' (leading white space), 'java' (leading white space, 'at ' or 'Caused by') or 'timestamp' (no timestamp at the start).", {"records"}),
+         filter(parser, "expression", "Print only the lines selected by an expression such as 'level>=WARN and prefix==tfe and msg~\"Timeout\"'.  The fields are level, prefix, thread, msg and line; they are compared with == != < <= > >= or searched for a regex with ~ and !~, and tests are combined with and, or, not and parentheses.", {'f', "filter"}),
+         includes(parser, "pattern", "Print only the lines that match one of these regexes.", {'i', "include"}),
+         excludes(parser, "pattern", "Don't print the lines that match any of these regexes.", {'x', "exclude"}),
+         dedup_millis(parser, "millis", "Print a line that repeats a line printed less than this long ago (ignoring any digits) only once, followed by a 'last message repeated N times' summary.", {"dedup"}),
+         stats_interval(parser, "seconds", "Print the statistics (lines and bytes read, lines printed, polling pass and directory scan times, how far behind each file is) this often.  They are also printed when Ctrl-Break is pressed.", {"stats-interval"}),
+         stats_file(parser, "path", "Write the statistics as JSON to this file whenever they are printed and on exit.", {"stats-file"}),
+         latency(parser, "latency", "Keep latency histograms (p50, p99, p99.9 and max) of the time from a file being written to its lines being printed, and of the read, match, format and write stages.  They are printed with the statistics and on exit.", {"latency"}),
+         timing(parser, "timing", "Print how long after starting the first files were being watched (with the time taken to compile the patterns and scan the directory) and the first line was printed.", {"timing"}),
+         search(parser, "pattern", "Instead of tailing the newest files, print the lines that match this regex in all of the files whose name matches the 'pattern' regex, oldest file first (in timestamp order with --merge), and exit.", {"search"}),
+         since(parser, "time", "Start tailing the files found at startup at their first line with a timestamp (see --timestamp) at or after this time instead of at their end: a duration before now such as 10m, 2h or 1d, a time of day today (HH:MM[:SS]) or a date and time (YYYY-MM-DD[ HH:MM[:SS]]).", {"since"})
    {
       try {
          parser.ParseCLI(argc, argv);
@@ -240,6 +1171,28 @@ public:
    std::string getBeepPattern() {  return line_beep_pattern ? args::get(line_beep_pattern) : ""; }
    bool getBeep() {  return nobeep ? false : true; }
    int getMaxFiles() {  return max_files ? args::get(max_files) : 10; }
+   bool getOverlapped() {  return overlapped ? true : false; }
+   bool getNoCache() {  return nocache ? true : false; }
+   bool getMmap() {  return mmap ? true : false; }
+   bool getShowPrefix() {  return noprefix ? false : true; }
+   unsigned getMergeWindowMillis() {  return merge_window ? (unsigned)std::max(0, args::get(merge_window)) : 0; }
+   std::string getTimestampFormat() {  return timestamp_format ? args::get(timestamp_format) : ""; }
+   std::string getLineLayout() {  return line_layout ? args::get(line_layout) : ""; }
+   std::string getMinLevel() {  return min_level ? args::get(min_level) : ""; }
+   std::string getLevels() {  return levels ? args::get(levels) : ""; }
+   std::string getRecordRule() {  return records ? args::get(records) : ""; }
+   std::string getFilter() {  return filter ? args::get(filter) : ""; }
+   std::vector<std::string> getIncludes() {  return includes ? args::get(includes) : std::vector<std::string>(); }
+   std::vector<std::string> getExcludes() {  return excludes ? args::get(excludes) : std::vector<std::string>(); }
+   unsigned getDedupMillis() {  return dedup_millis ? (unsigned)std::max(0, args::get(dedup_millis)) : 0; }
+   unsigned getStatsIntervalMillis() {  return stats_interval ? (unsigned)std::max(0, args::get(stats_interval)) * 1000 : 0; }
+   std::string getStatsFile() {  return stats_file ? args::get(stats_file) : ""; }
+   bool getLatency() {  return latency ? true : false; }
+   bool getTiming() {  return timing ? true : false; }
+   std::string getSearch() {  return search ? args::get(search) : ""; }
+   std::string getSince() {  return since ? args::get(since) : ""; }
+   unsigned getPartialMillis() {  return partial_millis ? (unsigned)std::max(0, args::get(partial_millis)) : 0; }
+   unsigned getDrainMillis() {  return drain_millis ? (unsigned)std::max(0, args::get(drain_millis)) : DEFAULT_DRAIN_MILLIS; }
 };
 
 
@@ -247,6 +1200,22 @@ public:
 // utility functions
 //
 
+/** current value of the high resolution performance counter */
+int64_t perf_counter() {
+   LARGE_INTEGER counter;
+   QueryPerformanceCounter(&counter);
+   return counter.QuadPart;
+}
+
+/** nanoseconds in a difference between two values of the performance counter */
+uint64_t perf_nanos(int64_t ticks) {
+   static const double nanosPerTick = [] {
+      LARGE_INTEGER freq;
+      return QueryPerformanceFrequency(&freq) && freq.QuadPart > 0 ? 1e9 / freq.QuadPart : 1.0;
+   }();
+   return ticks > 0 ? (uint64_t)(ticks * nanosPerTick) : 0;
+}
+
 int64_t filetime_to_unix_time(FILETIME &fileTime) {
    //Get the number of seconds since January 1, 1970 12:00am UTC
    const int64_t UNIX_TIME_START = 0x019DB1DED53E8000; // January 1, 1970 (start of Unix epoch) in "ticks"
@@ -262,6 +1231,14 @@ int64_t filetime_to_unix_time(FILETIME &fileTime) {
    return (li.QuadPart - UNIX_TIME_START) / TICKS_PER_SECOND;
 }
 
+/** local time in milliseconds since 1970-01-01, in the terms of TimestampFormat::parse */
+int64_t local_time_millis() {
+   SYSTEMTIME now;
+   GetLocalTime(&now);
+   return (days_from_civil(now.wYear, now.wMonth, now.wDay) * 86400 + now.wHour * 3600 + now.wMinute * 60 + now.wSecond) * 1000
+          + now.wMilliseconds;
+}
+
 std::string & ltrim(std::string & str) {
    auto it2 = std::find_if(str.begin(), str.end(), [](char ch) { return !std::isspace<char>(ch, std::locale::classic()); });
    str.erase(str.begin(), it2);
@@ -294,11 +1271,20 @@ std::string get_last_error() {
    return sstr.str();
 }
 
-SharedUniqueFileHandlePtr open_file_handle(fs::path path) {
+/**
+ * Returns true if the path is on a local fixed drive.  A mapped view of a file on a network share
+ * or a removable drive raises an in-page error whenever a page of it can't be read in.
+ */
+bool is_local_fixed_drive(const fs::path &path) {
+   wchar_t root[MAX_PATH];
+   return GetVolumePathName(fs::absolute(path).c_str(), root, MAX_PATH) && GetDriveType(root) == DRIVE_FIXED;
+}
+
+SharedUniqueFileHandlePtr open_file_handle(fs::path path, DWORD access, DWORD flags) {
    SharedUniqueFileHandlePtr sharedHandle;
-   HANDLE hFile = CreateFile(path.c_str(), 0,
+   HANDLE hFile = CreateFile(path.c_str(), access,
                              FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
-                             OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+                             OPEN_EXISTING, flags, NULL);
    if (hFile != INVALID_HANDLE_VALUE) {
       unique_handle<GenericHandlePolicy> *pUH = new unique_handle<GenericHandlePolicy>(hFile);
       sharedHandle.reset(pUH);
@@ -311,49 +1297,72 @@ SharedUniqueFileHandlePtr open_file_handle(fs::path path) {
 // program code
 //
 
-std::shared_ptr<PrefixLogFileInfoMap> collectLogFiles(fs::path &logdir, std::regex &filename_regex) {
-   PrefixLogFileInfoMap *pmap = new PrefixLogFileInfoMap{100};
-   std::unordered_map<std::string, std::shared_ptr<LogFileInfoList>> prefixToFileListPtrMap{100};
+/**
+ * Matches the names of entries [begin, end) against the file name pattern and keeps the index of
+ * the newest (by create time) entry of each prefix, the first one listed if several are as new.
+ */
+void matchLogFiles(const std::vector<FileEntry> &entries, size_t begin, size_t end, const std::regex &filename_regex,
+                   std::unordered_map<std::string, size_t> &newest) {
    std::smatch match;
-   for (const auto &entry : fs::directory_iterator(logdir)) {
-      const fs::path path = entry.path();
-      if (fs::exists(path) && !fs::is_directory(path)) {
-         fs::path filename = path.filename();
-         std::string str = filename.string();
-
-         if (std::regex_search(str, match, filename_regex)) {
-            std::string prefix = match[1];
-            if (!prefix.empty()) {
-               std::shared_ptr<LogFileInfoList> listPtr;
-               auto entryIt = prefixToFileListPtrMap.find(prefix);
-               if(entryIt != prefixToFileListPtrMap.end()) {
-                  listPtr = entryIt->second;
-               } else {
-                  LogFileInfoList *fileList = new LogFileInfoList();
-                  listPtr = std::shared_ptr<LogFileInfoList>(fileList);
-                  prefixToFileListPtrMap.emplace(prefix, listPtr);
-               }
-               std::shared_ptr<LogFileInfo> ptr(new LogFileInfo(prefix, path));
-               listPtr->push_back(ptr);
+   for (size_t i = begin; i < end; i++) {
+      std::string str = entries[i].path.filename().string();
+      if (std::regex_search(str, match, filename_regex)) {
+         std::string prefix = match[1];
+         if (!prefix.empty()) {
+            auto it = newest.find(prefix);
+            if (it == newest.end()) {
+               newest.emplace(prefix, i);
+            } else if (entries[i].status.createTime > entries[it->second].status.createTime) {
+               it->second = i;
             }
          }
       }
    }
+}
 
-   // sort the list of files that match each prefix by their timestamp
-   // add the most recent one to the output map
-   for(auto entry : prefixToFileListPtrMap) {
-      std::string prefix = entry.first;
-      std::shared_ptr<LogFileInfoList> value = entry.second;
-      if (!value->empty()) {
-         value->sort([](std::shared_ptr<LogFileInfo> pList0, std::shared_ptr<LogFileInfo> pList1) {
-            return pList0->getCreateTime() > pList1->getCreateTime();   // largest (most-recent) to smallest
-         });
+/**
+ * Finds the newest file of each prefix.  In a directory with many files the names are matched on
+ * several threads, each taking a contiguous share of the listing; the pattern is only read, so
+ * they all share it.  Only the newest file of each prefix gets a LogFileInfo.
+ */
+std::shared_ptr<PrefixLogFileInfoMap> collectLogFiles(fs::path &logdir, const std::regex &filename_regex, FileSystem &fileSystem, Clock &clock,
+                                                      size_t *plisted = nullptr) {
+   PrefixLogFileInfoMap *pmap = new PrefixLogFileInfoMap{100};
+   std::vector<FileEntry> entries;
+   fileSystem.listFiles(logdir, entries);
+   if (plisted != nullptr) {
+      *plisted = entries.size();
+   }
 
-         std::shared_ptr<LogFileInfo> pinfo = value->front();
-         pmap->emplace(prefix, pinfo);
+   size_t threads = (entries.size() + SCAN_NAMES_PER_THREAD - 1) / SCAN_NAMES_PER_THREAD;
+   threads = std::max<size_t>(1, std::min<size_t>(threads, std::thread::hardware_concurrency()));
+   size_t share = (entries.size() + threads - 1) / threads;
+   std::vector<std::unordered_map<std::string, size_t>> newest(threads);
+   std::vector<std::thread> workers;
+   for (size_t t = 1; t < threads; t++) {
+      workers.emplace_back(matchLogFiles, std::cref(entries), std::min(t * share, entries.size()), std::min((t + 1) * share, entries.size()),
+                           std::cref(filename_regex), std::ref(newest[t]));
+   }
+   matchLogFiles(entries, 0, std::min(share, entries.size()), filename_regex, newest[0]);
+   for (std::thread &worker : workers) {
+      worker.join();
+   }
+
+   // the shares are merged in listing order, so a tie goes to the file listed first
+   for (size_t t = 1; t < threads; t++) {
+      for (auto &entry : newest[t]) {
+         auto it = newest[0].find(entry.first);
+         if (it == newest[0].end()) {
+            newest[0].emplace(entry);
+         } else if (entries[entry.second].status.createTime > entries[it->second].status.createTime) {
+            it->second = entry.second;
+         }
       }
    }
+   for (auto &entry : newest[0]) {
+      std::shared_ptr<LogFileInfo> pinfo(new LogFileInfo(entry.first, entries[entry.second].path, fileSystem, clock));
+      pmap->emplace(entry.first, pinfo);
+   }
 
    return std::shared_ptr<PrefixLogFileInfoMap>(pmap);
 }
@@ -370,8 +1379,14 @@ void showTooManyFilesMessage(std::shared_ptr<PrefixLogFileInfoMap> pmap, unsigne
    }
 }
 
-std::shared_ptr<PrefixLogFileInfoMap> collectInitialLogFiles(fs::path &logdir, std::regex &filename_regex, unsigned max_files) {
-   std::shared_ptr<PrefixLogFileInfoMap> pmap = collectLogFiles(logdir, filename_regex);
+/**
+ * Finds the files to watch at startup.  With 'psinceFormat' they are tailed from their first line
+ * with a timestamp at or after 'since', otherwise from their end.
+ */
+std::shared_ptr<PrefixLogFileInfoMap> collectInitialLogFiles(fs::path &logdir, const std::regex &filename_regex, unsigned max_files,
+                                                             FileSystem &fileSystem, Clock &clock, size_t *plisted = nullptr,
+                                                             const TimestampFormat *psinceFormat = nullptr, int64_t since = 0) {
+   std::shared_ptr<PrefixLogFileInfoMap> pmap = collectLogFiles(logdir, filename_regex, fileSystem, clock, plisted);
    if (pmap) {
       if(pmap->size() <= max_files) {
          std::cout << "Press CTRL-C to exit." << std::endl;
@@ -379,7 +1394,11 @@ std::shared_ptr<PrefixLogFileInfoMap> collectInitialLogFiles(fs::path &logdir, s
             std::cout << "********* WARNING: no files found that match the file name regular expression." << std::endl;
          } else {
             for (auto entry : *pmap) {
-               entry.second->startWatching();
+               if (psinceFormat != nullptr) {
+                  entry.second->startWatchingSince(since, *psinceFormat);
+               } else {
+                  entry.second->startWatching();
+               }
             }
          }
       } else {
@@ -390,7 +1409,7 @@ std::shared_ptr<PrefixLogFileInfoMap> collectInitialLogFiles(fs::path &logdir, s
    return pmap;
 }
 
-void updateLogFilesMap(std::shared_ptr<PrefixLogFileInfoMap> oldMap, std::shared_ptr<PrefixLogFileInfoMap> newMap, unsigned max_files) {
+void updateLogFilesMap(std::shared_ptr<PrefixLogFileInfoMap> oldMap, std::shared_ptr<PrefixLogFileInfoMap> newMap, unsigned max_files, Clock &clock) {
    std::set<std::string> oldKeys;
    std::set<std::string> newKeys;
    std::set<std::string> removed;
@@ -399,8 +1418,18 @@ void updateLogFilesMap(std::shared_ptr<PrefixLogFileInfoMap> oldMap, std::shared
    std::set_difference(oldKeys.begin(),oldKeys.end(),newKeys.begin(),newKeys.end(),std::inserter(removed,removed.end()));
    for (auto oldKey : removed) {
       auto pOldValue = oldMap->at(oldKey);
-      pOldValue->stopWatching();
-      oldMap->erase(oldKey);
+      if (pOldValue->isUnlinked()) {
+         // already being drained
+      } else if (pOldValue->isDeletedButOpen()) {
+         // the writer may still be appending to it -- tailAllFiles releases it once it stops growing
+         std::cout << "********* " << oldKey << ": DELETED " << pOldValue->getPath().filename() << " (draining until it stops growing)" << std::endl;
+         TRACE_ROTATION(oldKey, "deleted", pOldValue->getPath(), pOldValue->getPath());
+         pOldValue->setUnlinked(true);
+         pOldValue->setLastChange(clock.tickCount());
+      } else {
+         pOldValue->stopWatching();
+         oldMap->erase(oldKey);
+      }
    }
    for (auto newEntry : *newMap) {
       auto oldEntryIt = oldMap->find(newEntry.first);
@@ -415,56 +1444,547 @@ void updateLogFilesMap(std::shared_ptr<PrefixLogFileInfoMap> oldMap, std::shared
       }
       else {
          std::string prefix = oldEntryIt->first;
-         auto oldFilePath = oldEntryIt->second->getPath();
-         auto newFilePath = newEntry.second->getPath();
-         if (oldFilePath.compare(newFilePath) != 0) {
-            oldEntryIt->second->stopWatching();
-            newEntry.second->startWatching();
-            oldMap->insert_or_assign(prefix, newEntry.second);
+         auto pOldInfo = oldEntryIt->second;
+         auto pNewInfo = newEntry.second;
+         auto oldFilePath = pOldInfo->getPath();
+         auto newFilePath = pNewInfo->getPath();
+         // compare the files themselves when possible -- the same name can now belong to a different
+         // file (rename rotation) and the watched file can show up under a new name
+         FileIdentity oldId = pOldInfo->getIdentity();
+         FileIdentity newId = pNewInfo->getIdentity();
+         bool sameFile = (oldId.isValid() && newId.isValid()) ? (oldId == newId) : (oldFilePath.compare(newFilePath) == 0);
+         if (sameFile && oldFilePath.compare(newFilePath) != 0) {
+            std::cout << "********* " << prefix << ": RENAMED " << oldFilePath.filename() << " TO " << newFilePath.filename() << std::endl;
+            TRACE_ROTATION(prefix, "renamed", oldFilePath, newFilePath);
+            pOldInfo->setPath(newFilePath);
+         } else if (!sameFile) {
+            // the old file stays open until it has been drained, see drainPredecessor()
+            std::cout << "********* " << prefix << ": ROTATING TO " << newFilePath.filename() << std::endl;
+            TRACE_ROTATION(prefix, "rotated", oldFilePath, newFilePath);
+            pNewInfo->setPredecessor(pOldInfo);
+            oldMap->insert_or_assign(prefix, pNewInfo);
+         }
+      }
+   }
+}
+
+/**
+ * Decides if the line is printed: checks its level, the filter expression and if it repeats a
+ * line printed recently.  The level and the filter each remember their own verdict on the last
+ * line they could judge, so a line that has neither a level nor the fields the filter needs
+ * follows that line for each of them.
+ */
+bool selectLine(LogFileInfo &info, const char *line, size_t len, const std::string &label, TailContext &ctx) {
+   if (ctx.levelMask != ALL_LEVELS) {
+      // only the start of the line is looked at; lines without a level (stack traces,
+      // continuations) are dropped or kept together with the line before them
+      LogLevel level;
+      if (ctx.playout->parseLevel(line, len, level)) {
+         info.setLevelDropping((ctx.levelMask & level_bit(level)) == 0);
+      }
+      if (info.isLevelDropping()) {
+         return false;
+      }
+   }
+   if (ctx.pfilter != nullptr) {
+      // a filter on the fields of the layout can't judge continuation lines on their own either
+      LineFields fields;
+      bool judged = true;
+      if (ctx.pfilter->needsLayout()) {
+         judged = ctx.playout->parse(line, len, fields);
+      }
+      if (judged) {
+         FilterInput input{info.getPrefix(), std::string_view(line, len), &fields};
+         info.setFilterDropping(!ctx.pfilter->matches(input));
+      }
+      if (info.isFilterDropping()) {
+         return false;
+      }
+   }
+   return ctx.prepeats == nullptr || !ctx.prepeats->suppress(info.getPrefix(), label, line, len, info.getLastTimestamp(), ctx.sink, ctx.pmerge);
+}
+
+void printLine(LogFileInfo &info, const char *line, size_t len, TailContext &ctx) {
+   ctx.stats.linesRead++;
+   if (len > 0 && line[len - 1] == '\r') {
+      --len;
+   }
+   static const std::string noLabel;
+   const std::string &label = ctx.showPrefix ? info.getLabel() : noLabel;
+   int64_t start = ctx.stats.latency ? perf_counter() : 0;
+   if (!selectLine(info, line, len, label, ctx)) {
+      if (ctx.stats.latency) {
+         ctx.stats.matchLatency.record(perf_nanos(perf_counter() - start));
+      }
+      return;
+   }
+   ctx.stats.linesPrinted++;
+   TRACE_LINE(info.getPrefix(), len);
+   int64_t selected = ctx.stats.latency ? perf_counter() : 0;
+   if (ctx.pmerge != nullptr) {
+      // lines without a timestamp (stack traces, continuations) stay with the line before them
+      int64_t timestamp;
+      if (ctx.pmerge->getFormat().parse(line, len, timestamp)) {
+         info.setLastTimestamp(timestamp);
+      } else {
+         timestamp = info.getLastTimestamp();
+      }
+      ctx.pmerge->push(timestamp, label, line, len, ctx.sink);
+   } else if (ctx.recordRule != RecordRule::None) {
+      ctx.sink.writeRecord(label, line, len);
+   } else {
+      ctx.sink.writeLine(label, line, len);
+   }
+   int64_t formatted = ctx.stats.latency ? perf_counter() : 0;
+   if (ctx.pbeep_regex != nullptr) {
+      if (std::regex_search(line, line + len, *ctx.pbeep_regex)) {
+         TRACE_REGEX_MATCH(info.getPrefix());
+         ctx.sink.flush();   // show the line before beeping
+         Beep(500, 500);     // MessageBeep(MB_OK)  would add dependency on User32.dll, so far we only have depenencies on Kernel32.dll
+      }
+   }
+   if (ctx.stats.latency) {
+      ctx.stats.matchLatency.record(perf_nanos(selected - start + perf_counter() - formatted));
+      ctx.stats.formatLatency.record(perf_nanos(formatted - selected));
+   }
+}
+
+/** prints the file's pending multi-line record, if any */
+void flushRecord(LogFileInfo &info, TailContext &ctx) {
+   std::string &pending = info.getPendingRecord();
+   if (!pending.empty()) {
+      printLine(info, pending.data(), pending.size(), ctx);
+      pending.clear();
+   }
+}
+
+/**
+ * Adds a line that isn't in the read buffer (it was joined with a partial line) to the file's
+ * pending record, printing the pending record first if the line starts a new one.
+ */
+void addRecordLine(LogFileInfo &info, const char *line, size_t len, TailContext &ctx) {
+   std::string &pending = info.getPendingRecord();
+   if (!pending.empty() && is_continuation(ctx.recordRule, ctx.playout->getTimestampFormat(), line, len)) {
+      pending += '\n';
+   } else {
+      flushRecord(info, ctx);
+   }
+   pending.append(line, len);
+   info.setRecordChanged(ctx.pclock->tickCount());
+}
+
+/**
+ * Prints a line joined with the file's partial line, as part of a record when they are assembled.
+ * 'recordStart' is the record still open in the read buffer, which is moved to the file's pending
+ * record first.
+ */
+void printJoinedLine(LogFileInfo &info, const std::string &line, const char *&recordStart, const char *recordEnd, TailContext &ctx) {
+   if (ctx.recordRule == RecordRule::None) {
+      printLine(info, line.data(), line.size(), ctx);
+      return;
+   }
+   if (recordStart != nullptr) {
+      info.getPendingRecord().assign(recordStart, recordEnd - recordStart);
+      recordStart = nullptr;
+   }
+   addRecordLine(info, line.data(), line.size(), ctx);
+}
+
+/**
+ * Splits a block of data read from the file into lines and prints the complete ones.  Bytes after
+ * the last newline are kept in the file's partial line until the rest of the line is read.
+ *
+ * When multi-line records are assembled, a line and the continuation lines after it are printed
+ * together as one record straight from the block.  Only the record still open at the end of the
+ * block is copied, to the file's pending record, since the next block may add lines to it.
+ */
+void splitLines(LogFileInfo &info, const char *data, size_t len, TailContext &ctx) {
+   ctx.stats.bytesRead += len;
+   if (ctx.stats.latency && ctx.readStarted != 0) {
+      ctx.stats.readLatency.record(perf_nanos(perf_counter() - ctx.readStarted));
+   }
+   ctx.readStarted = 0;
+   std::string &partial = info.getPartialLine();
+   std::string &pending = info.getPendingRecord();
+   const char *recordStart = nullptr;   // record being assembled in the block
+   const char *recordEnd = nullptr;
+   const char *end = data + len;
+   const char *p = data;
+   while (p < end) {
+      const char *eol = (const char *)memchr(p, '\n', end - p);
+      if (eol == nullptr) {
+         partial.append(p, end - p);
+         info.setPartialChanged(ctx.pclock->tickCount());
+         break;
+      }
+      if (!partial.empty()) {
+         if (info.getPartialPrinted() == 0) {
+            partial.append(p, eol - p);
+            printJoinedLine(info, partial, recordStart, recordEnd, ctx);
+         } else {
+            // the start of the line was already printed when it timed out -- print the rest
+            std::string rest = CONTINUATION_MARKER + partial.substr(info.getPartialPrinted());
+            rest.append(p, eol - p);
+            printJoinedLine(info, rest, recordStart, recordEnd, ctx);
+         }
+         info.clearPartialLine();
+      } else if (ctx.recordRule == RecordRule::None) {
+         printLine(info, p, eol - p, ctx);
+      } else {
+         bool continuation = is_continuation(ctx.recordRule, ctx.playout->getTimestampFormat(), p, eol - p);
+         if (continuation && recordStart != nullptr) {
+            recordEnd = eol;
+         } else if (continuation && !pending.empty()) {
+            addRecordLine(info, p, eol - p, ctx);
+         } else {
+            if (recordStart != nullptr) {
+               printLine(info, recordStart, recordEnd - recordStart, ctx);
+            } else {
+               flushRecord(info, ctx);
+            }
+            recordStart = p;
+            recordEnd = eol;
          }
       }
+      p = eol + 1;
+   }
+   if (recordStart != nullptr) {
+      pending.assign(recordStart, recordEnd - recordStart);
+      info.setRecordChanged(ctx.pclock->tickCount());
+   }
+}
+
+/**
+ * Prints the part of the file's unterminated last line that hasn't been printed yet.  A line
+ * that may still be completed is flagged with PARTIAL_MARKER and its continuation is printed
+ * by splitLines once the newline arrives.  'final' is set when no more data will be read from
+ * the file, in which case the partial line is discarded afterwards.
+ */
+void printPartialLine(LogFileInfo &info, TailContext &ctx, bool final) {
+   flushRecord(info, ctx);
+   std::string &partial = info.getPartialLine();
+   size_t printed = info.getPartialPrinted();
+   if (partial.size() > printed) {
+      std::string record = (printed > 0 ? CONTINUATION_MARKER : "") + partial.substr(printed) + (final ? "" : PARTIAL_MARKER);
+      printLine(info, record.data(), record.size(), ctx);
+      info.setPartialPrinted(partial.size());
+   }
+   if (final) {
+      info.clearPartialLine();
    }
 }
 
-void tailOneFile(LogFileInfo &info, int64_t fileSize, int64_t writeTime, std::regex *pbeep_regex) {
+/**
+ * Prints the unterminated last lines that haven't changed for the partial line timeout, e.g.
+ * progress messages and prompts written without a newline.  Only the carried-over bytes are
+ * used, so this never costs an extra read.
+ */
+void printStalePartialLines(std::shared_ptr<PrefixLogFileInfoMap> pmap, TailContext &ctx) {
+   if (ctx.partialMillis > 0) {
+      ULONGLONG now = ctx.pclock->tickCount();
+      for (auto entry : *pmap) {
+         LogFileInfo &info = *entry.second;
+         if (info.getPartialLine().size() > info.getPartialPrinted() && now - info.getPartialChanged() >= ctx.partialMillis) {
+            printPartialLine(info, ctx, false);
+         }
+      }
+   }
+}
+
+/**
+ * Prints the multi-line records no line has been added to for RECORD_FLUSH_MILLIS, or all of
+ * them when the worker thread exits.
+ */
+void printStaleRecords(std::shared_ptr<PrefixLogFileInfoMap> pmap, TailContext &ctx, bool all) {
+   if (ctx.recordRule != RecordRule::None) {
+      ULONGLONG now = ctx.pclock->tickCount();
+      for (auto entry : *pmap) {
+         LogFileInfo &info = *entry.second;
+         if (all || now - info.getRecordChanged() >= RECORD_FLUSH_MILLIS) {
+            flushRecord(info, ctx);
+         }
+      }
+   }
+}
+
+/**
+ * Overlapped I/O engine.  Every watched file is associated with one I/O completion port.  The
+ * reads for all of the files that grew are issued together while the files are polled and the
+ * completions are then dequeued in batches and handed straight to the line splitter.
+ */
+class OverlappedReader {
+private:
+   unique_handle<GenericHandlePolicy> port;
+   unsigned outstanding{0};
+
+   bool issueRead(LogFileInfo &info) {
+      int64_t pos = info.getLastTailedPosition();
+      OVERLAPPED *pov = info.getOverlapped();
+      *pov = OVERLAPPED{};
+      pov->Offset = (DWORD)pos;
+      pov->OffsetHigh = (DWORD)(pos >> 32);
+      DWORD toRead = (DWORD)std::min<int64_t>(info.getReadTarget() - pos, READBUF_LEN);
+      info.setReadStarted(perf_counter());
+      // a read that completes immediately still queues its completion packet on the port
+      return ReadFile(info.getHandle(), info.getReadBuffer(), toRead, NULL, pov) || GetLastError() == ERROR_IO_PENDING;
+   }
+
+public:
+   OverlappedReader() : port{CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1)} {}
+
+   bool isValid() const { return port ? true : false; }
+
+   bool attach(LogFileInfo &info) {
+      return CreateIoCompletionPort(info.getHandle(), port.get(), (ULONG_PTR)&info, 0) != NULL;
+   }
+
+   void startRead(LogFileInfo &info, int64_t fileSize) {
+      info.setReadTarget(fileSize);
+      if (issueRead(info)) {
+         ++outstanding;
+      }
+   }
+
+   void completeReads(TailContext &ctx) {
+      OVERLAPPED_ENTRY entries[MAX_COMPLETIONS];
+      while (outstanding > 0) {
+         ULONG count = 0;
+         if (!GetQueuedCompletionStatusEx(port.get(), entries, MAX_COMPLETIONS, &count, INFINITE, FALSE)) {
+            ctx.sink.flush();
+            std::cout << "********* GetQueuedCompletionStatusEx failed.  Error=" << get_last_error() << std::endl;
+            outstanding = 0;
+            break;
+         }
+         for (ULONG i = 0; i < count; i++) {
+            LogFileInfo &info = *(LogFileInfo *)entries[i].lpCompletionKey;
+            DWORD bytesRead = entries[i].dwNumberOfBytesTransferred;
+            --outstanding;
+            if (bytesRead > 0) {
+               ctx.readStarted = info.getReadStarted();
+               splitLines(info, info.getReadBuffer(), bytesRead, ctx);
+               int64_t pos = info.getLastTailedPosition() + bytesRead;
+               info.setLastTailedPosition(pos);
+               if (pos < info.getReadTarget() && issueRead(info)) {
+                  ++outstanding;
+               }
+            }
+         }
+      }
+   }
+};
+
+void readAppendedData(LogFileInfo &info, int64_t fileSize, TailContext &ctx) {
+   int64_t pos = info.getLastTailedPosition();
+   while (pos < fileSize) {
+      DWORD bytesRead = 0;
+      ctx.readStarted = perf_counter();
+      if (!info.read(pos, fileSize - pos, bytesRead) || bytesRead == 0) {
+         break;
+      }
+      splitLines(info, info.getReadBuffer(), bytesRead, ctx);
+      pos += bytesRead;
+   }
+   info.setLastTailedPosition(pos);
+}
+
+/** reads the range from the last tailed position to 'fileSize' into the file's read buffer */
+void readBuffered(LogFileInfo &info, int64_t fileSize, TailContext &ctx) {
+   if (ctx.preader != nullptr) {
+      // the overlapped engine finishes the read once all of the files have been polled
+      ctx.preader->startRead(info, fileSize);
+   } else {
+      readAppendedData(info, fileSize, ctx);
+   }
+}
+
+/**
+ * Catch-up read of a large unread range that bypasses the file system cache.  The file we hold
+ * open is reopened with FILE_FLAG_NO_BUFFERING so data we read once and print never occupies the
+ * cache and evicts pages that other applications on the host need.  Reopening the handle rather
+ * than the path reads the same file even after it was renamed or replaced by rotation.
+ * Unbuffered reads must be sector aligned, so each read starts at the aligned offset below the
+ * current position and the leading bytes are skipped.  Whatever an unbuffered read fails on is
+ * read with ReadFile instead.  Returns false if the file can't be reopened for reading this way.
+ */
+bool readUncached(LogFileInfo &info, int64_t fileSize, TailContext &ctx) {
+   if (info.getHandle() == NULL) {
+      return false;
+   }
+   unique_handle<GenericHandlePolicy> handle(ReOpenFile(info.getHandle(), GENERIC_READ,
+                                                        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                                        FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN));
+   unique_handle<VirtualMemoryPolicy> buffer(VirtualAlloc(NULL, UNCACHED_READ_LEN, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+   if (!handle || handle.get() == INVALID_HANDLE_VALUE || !buffer) {
+      return false;
+   }
+   char *pbuf = (char *)buffer.get();
+   int64_t pos = info.getLastTailedPosition();
+   while (pos < fileSize) {
+      int64_t alignedPos = pos & ~(SECTOR_ALIGNMENT - 1);
+      DWORD skip = (DWORD)(pos - alignedPos);
+      OVERLAPPED ov{};
+      ov.Offset = (DWORD)alignedPos;
+      ov.OffsetHigh = (DWORD)(alignedPos >> 32);
+      DWORD bytesRead = 0;
+      ctx.readStarted = perf_counter();
+      if (!ReadFile(handle.get(), pbuf, UNCACHED_READ_LEN, &bytesRead, &ov) || bytesRead <= skip) {
+         break;
+      }
+      int64_t len = std::min<int64_t>(bytesRead - skip, fileSize - pos);
+      splitLines(info, pbuf + skip, (size_t)len, ctx);
+      pos += len;
+   }
+   info.setLastTailedPosition(pos);
+   if (pos < fileSize) {
+      readBuffered(info, fileSize, ctx);
+   }
+   return true;
+}
+
+/**
+ * Touches every page of a mapped view so the whole view is faulted in before it is split into
+ * lines.  Returns false if that raises an in-page error, e.g. when a file on a network share
+ * becomes unavailable.  Nothing in here may need unwinding because of the __try block.
+ */
+bool prefaultView(const char *view, size_t len) {
+   __try {
+      volatile char touch = 0;
+      for (size_t offset = 0; offset < len; offset += PAGE_SIZE) {
+         touch += view[offset];
+      }
+      if (len > 0) {
+         touch += view[len - 1];
+      }
+   }
+   __except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) {
+      return false;
+   }
+   return true;
+}
+
+/**
+ * Reads a large appended range by mapping it into memory and splitting the lines directly from
+ * the view, which saves copying every byte into the read buffer first.  The range is mapped in
+ * successive views and each view is unmapped as soon as it has been split: Windows refuses to
+ * shrink a file while a view of it is mapped, so holding views longer would make a writer's
+ * truncate fail.  Anything that can't be mapped is read with ReadFile instead.  Returns false
+ * if the file can't be mapped at all.
+ */
+bool readMapped(LogFileInfo &info, int64_t fileSize, TailContext &ctx) {
+   LARGE_INTEGER mappingSize;
+   mappingSize.QuadPart = fileSize;
+   unique_handle<GenericHandlePolicy> mapping(CreateFileMapping(info.getHandle(), NULL, PAGE_READONLY, mappingSize.HighPart, mappingSize.LowPart, NULL));
+   if (!mapping) {
+      return false;
+   }
+   int64_t pos = info.getLastTailedPosition();
+   while (pos < fileSize) {
+      int64_t viewPos = pos & ~(MAP_ALIGNMENT - 1);
+      SIZE_T viewLen = (SIZE_T)std::min<int64_t>(fileSize - viewPos, MAP_VIEW_LEN);
+      ctx.readStarted = perf_counter();
+      unique_handle<MappedViewPolicy> view(MapViewOfFile(mapping.get(), FILE_MAP_READ, (DWORD)(viewPos >> 32), (DWORD)viewPos, viewLen));
+      const char *pview = (const char *)view.get();
+      if (!view || !prefaultView(pview, viewLen)) {
+         break;
+      }
+      size_t skip = (size_t)(pos - viewPos);
+      splitLines(info, pview + skip, viewLen - skip, ctx);
+      pos = viewPos + viewLen;
+   }
+   info.setLastTailedPosition(pos);
+   if (pos < fileSize) {
+      readBuffered(info, fileSize, ctx);
+   }
+   return true;
+}
+
+/**
+ * Raw passthrough used when lines are printed unchanged (no prefix, beep, filtering or partial
+ * line timeout) and stdout isn't a console.  The appended range up to its last newline is mapped
+ * and written to stdout straight from the view, so the only copy of the data is the one the
+ * kernel makes into the pipe or file; only the bytes after the last newline are examined.  Bytes
+ * of an unterminated last line are left for the next pass, or for printLastLine().  Returns false
+ * if the file can't be mapped.
+ */
+bool passThrough(LogFileInfo &info, int64_t fileSize, TailContext &ctx) {
+   LARGE_INTEGER mappingSize;
+   mappingSize.QuadPart = fileSize;
+   unique_handle<GenericHandlePolicy> mapping(CreateFileMapping(info.getHandle(), NULL, PAGE_READONLY, mappingSize.HighPart, mappingSize.LowPart, NULL));
+   if (!mapping) {
+      return false;
+   }
+   int64_t pos = info.getLastTailedPosition();
+   while (pos < fileSize) {
+      int64_t viewPos = pos & ~(MAP_ALIGNMENT - 1);
+      SIZE_T viewLen = (SIZE_T)std::min<int64_t>(fileSize - viewPos, MAP_VIEW_LEN);
+      unique_handle<MappedViewPolicy> view(MapViewOfFile(mapping.get(), FILE_MAP_READ, (DWORD)(viewPos >> 32), (DWORD)viewPos, viewLen));
+      if (!view) {
+         break;
+      }
+      const char *start = (const char *)view.get() + (pos - viewPos);
+      const char *end = (const char *)view.get() + viewLen;
+      if (viewPos + (int64_t)viewLen == fileSize) {
+         while (end > start && end[-1] != '\n') {
+            --end;
+         }
+      }
+      if (end == start || !ctx.sink.writeAll(start, end - start)) {
+         break;
+      }
+      ctx.stats.bytesRead += end - start;
+      pos += end - start;
+   }
+   info.setLastTailedPosition(pos);
+   return true;
+}
+
+/**
+ * Prints what is left of the file's unterminated last line before the file is let go.  With the
+ * raw passthrough those bytes are still in the file, so they are read into the partial line
+ * first.
+ */
+void printLastLine(LogFileInfo &info, TailContext &ctx) {
+   if (ctx.rawPassthrough && info.isOpen() && info.getLastTailedPosition() < info.getFileSize()) {
+      readAppendedData(info, info.getFileSize(), ctx);
+   }
+   printPartialLine(info, ctx, true);
+}
+
+void tailOneFile(LogFileInfo &info, int64_t fileSize, int64_t writeTime, TailContext &ctx) {
    int64_t prevSize = info.getFileSize();
    if ((writeTime != info.getWriteTime()) || (fileSize != prevSize)) {
-      if (fileSize < prevSize) {
-         // file size has shrunk -- start tailing from new end of file
-         info.setLastTailedPosition(fileSize);
-      } else if(fileSize > prevSize) {
+      if (fileSize != prevSize) {
+         info.setLastChange(ctx.pclock->tickCount());
+      }
+      if (fileSize < prevSize || !info.checkFingerprint(fileSize)) {
+         // truncated, or rewritten in place since the last pass (possibly back to the same size,
+         // which only shows in the write time) -- everything in the file is new
+         ctx.sink.flush();
+         std::cout << "********* " << info.getPrefix() << ": " << (fileSize < prevSize ? "TRUNCATED " : "REWRITTEN ")
+                   << info.getPath().filename() << " (restarting at start of file)" << std::endl;
+         TRACE_ROTATION(info.getPrefix(), fileSize < prevSize ? "truncated" : "rewritten", info.getPath(), info.getPath());
+         info.setLastTailedPosition(0);
+         info.clearPartialLine();
+         info.resetFingerprint();
+         info.checkFingerprint(fileSize);
+         prevSize = 0;
+      }
+      if(fileSize > prevSize) {
          // data has been added to the file
-         std::ifstream ifs(info.getPath().c_str());
-         int64_t last_tail_pos = info.getLastTailedPosition();
-         ifs.seekg(last_tail_pos, std::ios_base::beg);
-         if (ifs.good()) {
-            std::unique_ptr<char> buf(new char[BUFLEN]);
-            std::streamsize pos = (std::streamsize)last_tail_pos;
-            char *pbuf = buf.get();
-            while (pos < fileSize) {
-               std::fill(pbuf,pbuf+BUFLEN,0);
-               ifs.getline(pbuf, BUFLEN);
-               std::streampos current_pos = ifs.tellg();
-               if (current_pos > pos) {
-                  pos = current_pos;
-                  if (!ifs.fail() && !ifs.eof()) {
-                     last_tail_pos = current_pos;
-                     std::string current_line(pbuf);
-                     std::cout << info.getPrefix() << ": " << current_line << std::endl;
-                     if (pbeep_regex != nullptr) {
-                        std::smatch match;
-                        if (std::regex_search(current_line, match, *pbeep_regex)) {
-                           Beep(500, 500);     // MessageBeep(MB_OK)  would add dependency on User32.dll, so far we only have depenencies on Kernel32.dll
-                        }
-                     }
-                  }
-               }
-               else {
-                  break;
-               }
-            }
+         if (ctx.stats.latency) {
+            info.setPendingWriteTime(writeTime);
+         }
+         int64_t unread = fileSize - info.getLastTailedPosition();
+         TRACE_FILE_READ(info.getPrefix(), info.getPath(), info.getLastTailedPosition(), unread, writeTime);
+         if (ctx.rawPassthrough && passThrough(info, fileSize, ctx)) {
+            // the data was copied to stdout without being split into lines
+         } else if (unread >= CATCHUP_THRESHOLD && ctx.bypassCache && readUncached(info, fileSize, ctx)) {
+            // the whole range was read without going through the cache
+         } else if (unread >= MMAP_THRESHOLD && ctx.mapLargeReads && readMapped(info, fileSize, ctx)) {
+            // the range was split directly from mapped views of the file
+         } else {
+            readBuffered(info, fileSize, ctx);
          }
-         info.setLastTailedPosition(last_tail_pos);
       }
 
       info.setFileSize(fileSize);
@@ -472,30 +1992,586 @@ void tailOneFile(LogFileInfo &info, int64_t fileSize, int64_t writeTime, std::re
    }
 }
 
-void tailAllFiles(std::shared_ptr<PrefixLogFileInfoMap> pmap, std::regex *pbeep_regex) {
+/** opens the file if it isn't open yet (and attaches it to the overlapped reader), returns true if it is open */
+bool openWatchedFile(LogFileInfo &info, TailContext &ctx) {
+   OverlappedReader *preader = ctx.preader;
+   if (!info.isOpen() && info.openHandle(preader != nullptr) && preader != nullptr && !preader->attach(info)) {
+      ctx.sink.flush();
+      std::cout << "********* " << info.getPrefix() << ": Unable to use overlapped I/O: " << get_last_error() << std::endl;
+      info.closeHandle();
+   }
+   return info.isOpen();
+}
+
+void tailWatchedFile(std::shared_ptr<LogFileInfo> pinfo, TailContext &ctx) {
+   std::string prefix = pinfo->getPrefix();
+   if (openWatchedFile(*pinfo, ctx)) {
+      int64_t fileSize;
+      int64_t writeTime;
+      if (pinfo->queryFileInfo(fileSize, writeTime)) {
+         tailOneFile(*pinfo, fileSize, writeTime, ctx);
+      }
+      else {
+         ctx.sink.flush();
+         std::cout << "********* " << prefix << ": Cannot get file time and/or size" << std::endl;
+      }
+   } else {
+      ctx.sink.flush();
+      std::cout << "********* " << prefix << ": Unable to open file handle" << std::endl;
+   }
+}
+
+/**
+ * Lossless rotation handoff.  When a newer file replaces the one being watched for a prefix the
+ * old file is kept open and tailed until a pass finds that it stopped growing (or its grace time
+ * runs out), so nothing written to it just before the rotation is lost.  Only then is the new file
+ * tailed, starting at offset 0.  Returns true once the file has no predecessor left to drain.
+ */
+bool drainPredecessor(LogFileInfo &info, TailContext &ctx) {
+   std::shared_ptr<LogFileInfo> pprev = info.getPredecessor();
+   if (!pprev) {
+      return true;
+   }
+   // hold the replacement open while it waits, or if it was renamed or deleted in turn before the
+   // predecessor is drained it would be opened by a name that now belongs to another file
+   openWatchedFile(info, ctx);
+   if (!drainPredecessor(*pprev, ctx)) {
+      return false;
+   }
+   ULONGLONG now = ctx.pclock->tickCount();
+   if (pprev->getDrainDeadline() == 0) {
+      pprev->setDrainDeadline(now + ROTATION_GRACE_MILLIS);
+   }
+   int64_t prevSize = pprev->getFileSize();
+   tailWatchedFile(pprev, ctx);
+   // the raw passthrough leaves an unterminated last line unread, it is printed by printLastLine()
+   bool drained = pprev->isOpen() && pprev->getFileSize() == prevSize && (pprev->getLastTailedPosition() >= prevSize || ctx.rawPassthrough);
+   if (pprev->isUnlinked()) {
+      // a deleted file is drained for as long as its writer keeps appending to it
+      if (pprev->isOpen() && !(drained && now - pprev->getLastChange() >= ctx.drainMillis)) {
+         return false;
+      }
+   } else if (!drained && pprev->isOpen() && now < pprev->getDrainDeadline()) {
+      return false;
+   }
+   if (ctx.preader != nullptr) {
+      // the grace time ran out with a read of the old file still in flight
+      ctx.preader->completeReads(ctx);
+   }
+   // the old file will never get the rest of its last line
+   printLastLine(*pprev, ctx);
+   ctx.sink.flush();
+   pprev->stopWatching();
+   info.setPredecessor(nullptr);
+   info.startWatching(true);
+   TRACE_FILE_SWITCH(info.getPrefix(), info.getPath());
+   return true;
+}
+
+/**
+ * Releases a deleted file once its size has stayed the same for the drain time, after printing
+ * whatever is left of its last line.  Returns true if the file was released.
+ */
+bool releaseIfDrained(LogFileInfo &info, TailContext &ctx) {
+   if (info.isOpen() && ctx.pclock->tickCount() - info.getLastChange() < ctx.drainMillis) {
+      return false;
+   }
+   if (ctx.preader != nullptr) {
+      ctx.preader->completeReads(ctx);
+   }
+   printLastLine(info, ctx);
+   ctx.sink.flush();
+   info.stopWatching();
+   return true;
+}
+
+void tailAllFiles(std::shared_ptr<PrefixLogFileInfoMap> pmap, TailContext &ctx) {
+   std::vector<std::string> released;
    for (auto entry : *pmap) {
-      std::string prefix = entry.first;
       auto pinfo = entry.second;
-      SharedUniqueFileHandlePtr hPtr = open_file_handle(pinfo->getPath());
-      if (hPtr) {
-         HANDLE h = hPtr->get();
-         FILETIME fileTime;
-         LARGE_INTEGER liSize;
-         bool bTime = GetFileTime(h, NULL, NULL, &fileTime);
-         bool bSize = GetFileSizeEx(h, &liSize);
-         hPtr.reset();
-         if (bTime && bSize) {
-            int64_t fileSize = liSize.QuadPart;
-            int64_t writeTime = filetime_to_unix_time(fileTime);
-            tailOneFile(*pinfo, fileSize, writeTime, pbeep_regex);
+      if (drainPredecessor(*pinfo, ctx)) {
+         tailWatchedFile(pinfo, ctx);
+         if (pinfo->isUnlinked() && releaseIfDrained(*pinfo, ctx)) {
+            released.push_back(entry.first);
          }
-         else {
-            std::cout << "********* " << prefix << ": Cannot get file time and/or size" << std::endl;
+      }
+   }
+   for (auto prefix : released) {
+      pmap->erase(prefix);
+   }
+   if (ctx.preader != nullptr) {
+      ctx.preader->completeReads(ctx);
+   }
+   printStaleRecords(pmap, ctx, false);
+   printStalePartialLines(pmap, ctx);
+   if (ctx.prepeats != nullptr) {
+      ctx.prepeats->reportExpired(ctx.sink, ctx.pmerge, false);
+   }
+   if (ctx.pmerge != nullptr) {
+      ctx.pmerge->release(ctx.sink, false);
+   }
+   ctx.sink.flush();
+   if (ctx.stats.latency) {
+      // the lines read on this pass are out -- measure from when their files were last written
+      int64_t now = ctx.pclock->currentTime();
+      for (auto entry : *pmap) {
+         LogFileInfo &info = *entry.second;
+         if (info.getPendingWriteTime() != 0) {
+            ctx.stats.detectLatency.record((uint64_t)std::max<int64_t>(now - info.getPendingWriteTime(), 0) * 1000000);
+            info.setPendingWriteTime(0);
+         }
+      }
+   }
+}
+
+/** escapes a string for a JSON string literal */
+std::string json_escape(const std::string &s) {
+   std::string escaped;
+   for (char ch : s) {
+      if (ch == '"' || ch == '\\') {
+         escaped += '\\';
+         escaped += ch;
+      } else if ((unsigned char)ch < 0x20) {
+         char buf[8];
+         snprintf(buf, sizeof(buf), "\\u%04x", ch);
+         escaped += buf;
+      } else {
+         escaped += ch;
+      }
+   }
+   return escaped;
+}
+
+/** latency histograms of the statistics with their names */
+std::vector<std::pair<const char *, const LatencyHistogram *>> latency_histograms(const Statistics &st) {
+   return { {"detect", &st.detectLatency}, {"read", &st.readLatency}, {"match", &st.matchLatency},
+            {"format", &st.formatLatency}, {"write", &st.writeLatency} };
+}
+
+/**
+ * Prints the statistics of the worker thread and how far behind each watched file is, and writes
+ * them to the snapshot file as JSON if one was requested.  The rates are for the time since the
+ * statistics were last reported.
+ */
+void reportStatistics(std::shared_ptr<PrefixLogFileInfoMap> pmap, TailContext &ctx, const fs::path &statsFile) {
+   Statistics &st = ctx.stats;
+   ULONGLONG now = ctx.pclock->tickCount();
+   double seconds = std::max<ULONGLONG>(now - st.reported, 1) / 1000.0;
+   double linesReadRate = (st.linesRead - st.reportedLinesRead) / seconds;
+   double linesPrintedRate = (st.linesPrinted - st.reportedLinesPrinted) / seconds;
+   double bytesRate = (st.bytesRead - st.reportedBytesRead) / seconds;
+   int64_t passAverage = st.passes > 0 ? st.micros(st.passTotal) / (int64_t)st.passes : 0;
+   int64_t scanAverage = st.scans > 0 ? st.micros(st.scanTotal) / (int64_t)st.scans : 0;
+
+   ctx.sink.flush();
+   std::cout << std::fixed << std::setprecision(1)
+             << "********* STATISTICS after " << (now - st.started) / 1000 << " s" << std::endl
+             << "  lines read:      " << st.linesRead << " (" << linesReadRate << "/s)" << std::endl
+             << "  lines printed:   " << st.linesPrinted << " (" << linesPrintedRate << "/s)" << std::endl
+             << "  bytes read:      " << st.bytesRead << " (" << bytesRate << "/s)" << std::endl
+             << "  polling passes:  " << st.passes << ", last " << st.micros(st.passLast) << " us, average " << passAverage
+             << " us, max " << st.micros(st.passMax) << " us" << std::endl
+             << "  directory scans: " << st.scans << ", last " << st.micros(st.scanLast) << " us, average " << scanAverage
+             << " us, max " << st.micros(st.scanMax) << " us" << std::endl;
+   for (auto entry : *pmap) {
+      LogFileInfo &info = *entry.second;
+      std::cout << "  " << entry.first << ": " << info.getFileSize() - info.getLastTailedPosition() << " bytes behind in "
+                << info.getPath().filename() << std::endl;
+   }
+   if (st.latency) {
+      std::cout << "  latency (us)     count        p50        p99      p99.9        max" << std::endl;
+      for (auto &named : latency_histograms(st)) {
+         const LatencyHistogram &h = *named.second;
+         std::cout << "  " << std::left << std::setw(12) << named.first << std::right << std::setw(10) << h.getCount()
+                   << std::setw(11) << h.percentile(50) / 1000.0 << std::setw(11) << h.percentile(99) / 1000.0
+                   << std::setw(11) << h.percentile(99.9) / 1000.0 << std::setw(11) << h.getMax() / 1000.0 << std::endl;
+      }
+   }
+   std::cout.unsetf(std::ios::floatfield);
+
+   if (!statsFile.empty()) {
+      // written to a temporary file that replaces the snapshot, so readers never see a partial one
+      fs::path tmpFile = statsFile;
+      tmpFile += ".tmp";
+      {
+         std::ofstream out(tmpFile, std::ios::trunc);
+         out << std::fixed << std::setprecision(1)
+             << "{\"uptime_ms\":" << now - st.started
+             << ",\"lines_read\":" << st.linesRead << ",\"lines_read_per_sec\":" << linesReadRate
+             << ",\"lines_printed\":" << st.linesPrinted << ",\"lines_printed_per_sec\":" << linesPrintedRate
+             << ",\"bytes_read\":" << st.bytesRead << ",\"bytes_read_per_sec\":" << bytesRate
+             << ",\"passes\":" << st.passes << ",\"pass_last_us\":" << st.micros(st.passLast)
+             << ",\"pass_avg_us\":" << passAverage << ",\"pass_max_us\":" << st.micros(st.passMax)
+             << ",\"scans\":" << st.scans << ",\"scan_last_us\":" << st.micros(st.scanLast)
+             << ",\"scan_avg_us\":" << scanAverage << ",\"scan_max_us\":" << st.micros(st.scanMax)
+             << ",\"files\":[";
+         const char *sep = "";
+         for (auto entry : *pmap) {
+            LogFileInfo &info = *entry.second;
+            out << sep << "{\"prefix\":\"" << json_escape(entry.first) << "\",\"path\":\"" << json_escape(info.getPath().string())
+                << "\",\"size\":" << info.getFileSize() << ",\"position\":" << info.getLastTailedPosition()
+                << ",\"lag_bytes\":" << info.getFileSize() - info.getLastTailedPosition() << "}";
+            sep = ",";
+         }
+         out << "]";
+         if (st.latency) {
+            out << ",\"latency_us\":{";
+            sep = "";
+            for (auto &named : latency_histograms(st)) {
+               const LatencyHistogram &h = *named.second;
+               out << sep << "\"" << named.first << "\":{\"count\":" << h.getCount() << ",\"p50\":" << h.percentile(50) / 1000.0
+                   << ",\"p99\":" << h.percentile(99) / 1000.0 << ",\"p99_9\":" << h.percentile(99.9) / 1000.0
+                   << ",\"max\":" << h.getMax() / 1000.0 << "}";
+               sep = ",";
+            }
+            out << "}";
+         }
+         out << "}" << std::endl;
+      }
+      if (!MoveFileEx(tmpFile.c_str(), statsFile.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+         std::cout << "********* Unable to write statistics to " << statsFile << ": " << get_last_error() << std::endl;
+      }
+   }
+
+   st.reported = now;
+   st.reportedLinesRead = st.linesRead;
+   st.reportedLinesPrinted = st.linesPrinted;
+   st.reportedBytesRead = st.bytesRead;
+}
+
+/**
+ * One polling pass of the worker thread: rescans the directory if it was modified, then tails all
+ * the files.  The simulation (simbench) drives the passes the same way.
+ */
+void pollFiles(std::shared_ptr<PrefixLogFileInfoMap> pmap, bool rescan, fs::path &logdir, const std::regex &filename_regex,
+               unsigned max_files, TailContext &ctx) {
+   TRACE_POLL_START(ctx.stats.passes);
+   if (rescan) {
+      int64_t scanStart = perf_counter();
+      std::shared_ptr<PrefixLogFileInfoMap> pNewMap = collectLogFiles(logdir, filename_regex, *ctx.pfs, *ctx.pclock);
+      updateLogFilesMap(pmap, pNewMap, max_files, *ctx.pclock);
+      ctx.stats.addScan(perf_counter() - scanStart);
+      TRACE_RESCAN((UINT32)pNewMap->size(), Statistics::micros(ctx.stats.scanLast));
+   }
+   int64_t passStart = perf_counter();
+   tailAllFiles(pmap,ctx);
+   ctx.stats.addPass(perf_counter() - passStart);
+   TRACE_POLL_END(ctx.stats.passes - 1, Statistics::micros(ctx.stats.passLast), (UINT32)pmap->size());
+   if (ctx.startTicks != 0 && ctx.sink.getBytesWritten() > 0) {
+      std::cout << "********* TIMING: first line after " << Statistics::micros(perf_counter() - ctx.startTicks) << " us" << std::endl;
+      ctx.startTicks = 0;
+   }
+}
+
+/** prints the lines still held back (records, repeat summaries, merged lines) when tailing stops */
+void flushHeldLines(std::shared_ptr<PrefixLogFileInfoMap> pmap, TailContext &ctx) {
+   printStaleRecords(pmap, ctx, true);
+   if (ctx.prepeats != nullptr) {
+      ctx.prepeats->reportExpired(ctx.sink, ctx.pmerge, true);
+   }
+   if (ctx.pmerge != nullptr) {
+      ctx.pmerge->release(ctx.sink, true);
+   }
+   ctx.sink.flush();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// historical search (--search)
+//
+
+/** a file searched by --search */
+struct SearchFile {
+   std::string label;                        // "prefix: " written in front of its lines
+   fs::path path;
+   int64_t size;
+   size_t firstTask;                         // the ranges of the file are the tasks [firstTask, endTask)
+   size_t endTask;
+};
+
+/** a matching line found by --search */
+struct SearchHit {
+   size_t offset;                            // of the line in SearchTask::text
+   size_t len;
+   int64_t timestamp;
+   bool dated;                               // the line starts with a timestamp (timestamp order only)
+};
+
+/**
+ * A range of a file searched by one thread of --search.  It owns the lines that start after
+ * 'begin' (at 0 for the first range of a file) up to and including 'end'.
+ */
+struct SearchTask {
+   size_t file;
+   int64_t begin;
+   int64_t end;
+   std::string text;                         // the matching lines, one after the other
+   std::vector<SearchHit> hits;
+   std::string error;                        // set if the range couldn't be mapped
+};
+
+/**
+ * Searches the range of a task in a view that extends up to SEARCH_MAX_LINE_LEN past it, for the
+ * end of its last line.  The line break the range starts in belongs to the range before it.  The
+ * file is mapped for the task alone, so only the ranges being searched are mapped at any time.
+ */
+void searchRange(SearchTask &task, const SearchFile &file, const SearchPattern &pattern, const TimestampFormat *ptimestamps) {
+   SharedUniqueFileHandlePtr handle = open_file_handle(file.path, GENERIC_READ, FILE_FLAG_SEQUENTIAL_SCAN);
+   LARGE_INTEGER mappingSize;
+   mappingSize.QuadPart = file.size;
+   unique_handle<GenericHandlePolicy> mapping;
+   if (handle) {
+      mapping.reset(CreateFileMapping(handle->get(), NULL, PAGE_READONLY, mappingSize.HighPart, mappingSize.LowPart, NULL));
+   }
+   SIZE_T viewLen = (SIZE_T)std::min<int64_t>(file.size - task.begin, task.end - task.begin + SEARCH_MAX_LINE_LEN);
+   unique_handle<MappedViewPolicy> view;
+   if (mapping) {
+      view.reset(MapViewOfFile(mapping.get(), FILE_MAP_READ, (DWORD)(task.begin >> 32), (DWORD)task.begin, viewLen));
+   }
+   if (!view) {
+      task.error = get_last_error();
+      return;
+   }
+   const char *pview = (const char *)view.get();
+   const char *p = pview;
+   if (task.begin > 0) {
+      p = (const char *)memchr(pview, '\n', viewLen);
+      p = p != nullptr ? p + 1 : pview + viewLen;
+   }
+   size_t rangeLen = (size_t)(task.end - task.begin);
+   const char *end = pview + viewLen;
+   if (rangeLen < viewLen) {
+      end = (const char *)memchr(pview + rangeLen, '\n', viewLen - rangeLen);
+      end = end != nullptr ? end + 1 : pview + viewLen;
+   }
+   const char *line;
+   size_t len;
+   while (pattern.find(p, end, line, len, p)) {
+      SearchHit hit{task.text.size(), len, 0, false};
+      hit.dated = ptimestamps != nullptr && ptimestamps->parse(line, len, hit.timestamp);
+      task.text.append(line, len);
+      task.hits.push_back(hit);
+   }
+}
+
+/**
+ * The threads of --search.  They search the tasks in the order they were requested, and the
+ * thread printing the lines waits for each task when it gets to it.  Tasks are only requested a
+ * little ahead of the printing, and released once printed, so the lines held in memory are those
+ * of the few tasks in flight.
+ */
+class SearchPool {
+private:
+   std::vector<SearchTask> &tasks;
+   const std::vector<SearchFile> &files;
+   const SearchPattern &pattern;
+   const TimestampFormat *ptimestamps;
+   std::vector<bool> requested;              // only used by the printing thread
+   std::mutex lock;
+   std::condition_variable changed;
+   std::deque<size_t> queue;                 // requested tasks not taken by a thread yet
+   std::vector<bool> searched;
+   bool stopping{false};
+   std::vector<std::thread> threads;
+
+   void run() {
+      std::unique_lock<std::mutex> guard(lock);
+      for (;;) {
+         changed.wait(guard, [this]() { return stopping || !queue.empty(); });
+         if (stopping) {
+            return;
+         }
+         size_t t = queue.front();
+         queue.pop_front();
+         guard.unlock();
+         searchRange(tasks[t], files[tasks[t].file], pattern, ptimestamps);
+         guard.lock();
+         searched[t] = true;
+         changed.notify_all();
+      }
+   }
+
+public:
+   SearchPool(std::vector<SearchTask> &t, const std::vector<SearchFile> &f, const SearchPattern &p, const TimestampFormat *pts) :
+         tasks{t}, files{f}, pattern{p}, ptimestamps{pts}, requested(t.size(), false), searched(t.size(), false) {
+      size_t count = std::max<size_t>(1, std::min<size_t>(tasks.size(), std::thread::hardware_concurrency()));
+      for (size_t i = 0; i < count; i++) {
+         threads.emplace_back([this]() { run(); });
+      }
+   }
+
+   ~SearchPool() {
+      {
+         std::lock_guard<std::mutex> guard(lock);
+         stopping = true;
+      }
+      changed.notify_all();
+      for (std::thread &thread : threads) {
+         thread.join();
+      }
+   }
+
+   size_t getThreads() const { return threads.size(); }
+
+   /** queues the task for the threads unless it was requested before */
+   void request(size_t t) {
+      if (t < tasks.size() && !requested[t]) {
+         requested[t] = true;
+         {
+            std::lock_guard<std::mutex> guard(lock);
+            queue.push_back(t);
+         }
+         changed.notify_all();
+      }
+   }
+
+   /** waits until the task was searched, requesting it first if it wasn't */
+   SearchTask &wait(size_t t) {
+      request(t);
+      std::unique_lock<std::mutex> guard(lock);
+      changed.wait(guard, [this, t]() { return (bool)searched[t]; });
+      return tasks[t];
+   }
+
+   /** frees the lines of a task that was printed */
+   void release(size_t t) {
+      std::string().swap(tasks[t].text);
+      std::vector<SearchHit>().swap(tasks[t].hits);
+   }
+};
+
+/** where the timestamp-ordered output of --search has got to in one file */
+struct SearchCursor {
+   size_t file;
+   size_t task;                              // the task with the next line of the file
+   size_t hit;                               // the next line in that task's hits
+   int64_t timestamp;                        // of the next line, or of the dated line before it
+};
+
+/**
+ * --search: prints the lines that match the pattern in every file whose name matches the file
+ * name pattern, oldest file first, or in timestamp order if 'ptimestamps' is given.  The files are
+ * split into ranges of MAP_VIEW_LEN that a pool of threads maps and searches in parallel while
+ * the lines found are printed.  In timestamp order the files are merged as the lines come in,
+ * taking the earliest next line of any file, so the lines of each file keep their order and lines
+ * with the same timestamp are printed oldest file first.  Returns the exit status.
+ */
+int searchLogFiles(fs::path &logdir, const std::regex &filename_regex, const SearchPattern &pattern, bool showPrefix,
+                   const TimestampFormat *ptimestamps) {
+   int64_t started = perf_counter();
+   SystemFileSystem fileSystem;
+   std::vector<FileEntry> entries;
+   fileSystem.listFiles(logdir, entries);
+   std::sort(entries.begin(), entries.end(), [](const FileEntry &a, const FileEntry &b) {
+      return a.status.createTime != b.status.createTime ? a.status.createTime < b.status.createTime : a.path < b.path;
+   });
+
+   std::vector<SearchFile> files;
+   std::vector<SearchTask> tasks;
+   int64_t bytes = 0;
+   std::smatch match;
+   for (const FileEntry &entry : entries) {
+      std::string str = entry.path.filename().string();
+      if (!std::regex_search(str, match, filename_regex) || match[1].length() == 0 || entry.status.size == 0) {
+         continue;
+      }
+      size_t firstTask = tasks.size();
+      for (int64_t begin = 0; begin < entry.status.size; begin += MAP_VIEW_LEN) {
+         tasks.push_back(SearchTask{files.size(), begin, std::min(begin + MAP_VIEW_LEN, entry.status.size)});
+      }
+      files.push_back(SearchFile{std::string(match[1]) + ": ", entry.path, entry.status.size, firstTask, tasks.size()});
+      bytes += entry.status.size;
+   }
+
+   static const std::string noLabel;
+   OutputSink sink;
+   size_t printed = 0;
+   auto printLine = [&](const SearchTask &task, const SearchHit &hit) {
+      sink.writeLine(showPrefix ? files[task.file].label : noLabel, task.text.data() + hit.offset, hit.len);
+      printed++;
+   };
+   auto reportError = [&](const SearchTask &task) {
+      if (!task.error.empty()) {
+         sink.flush();
+         std::cout << "********* Unable to search " << files[task.file].path.filename() << " from offset " << task.begin << ": " << task.error << std::endl;
+      }
+   };
+   {
+      SearchPool pool(tasks, files, pattern, ptimestamps);
+      if (ptimestamps == nullptr) {
+         // the files one after the other, with a couple of tasks per thread searched ahead
+         size_t ahead = 2 * pool.getThreads();
+         for (size_t t = 0; t < tasks.size(); t++) {
+            for (size_t next = t; next < t + ahead; next++) {
+               pool.request(next);
+            }
+            SearchTask &task = pool.wait(t);
+            reportError(task);
+            for (const SearchHit &hit : task.hits) {
+               printLine(task, hit);
+            }
+            pool.release(t);
          }
       } else {
-         std::cout << "********* " << prefix << ": Unable to open file handle" << std::endl;
+         // moves a cursor to the next line of its file (searching the range after the one it moves
+         // to ahead), returns false at the end of the file
+         auto nextLine = [&](SearchCursor &cursor) {
+            for (;;) {
+               SearchTask &task = pool.wait(cursor.task);
+               if (cursor.hit < task.hits.size()) {
+                  // lines without a timestamp (stack traces, continuations) stay with the matching line before them
+                  const SearchHit &hit = task.hits[cursor.hit];
+                  if (hit.dated) {
+                     cursor.timestamp = hit.timestamp;
+                  }
+                  return true;
+               }
+               reportError(task);
+               pool.release(cursor.task);
+               if (++cursor.task == files[cursor.file].endTask) {
+                  return false;
+               }
+               cursor.hit = 0;
+               if (cursor.task + 1 < files[cursor.file].endTask) {
+                  pool.request(cursor.task + 1);
+               }
+            }
+         };
+         auto later = [](const SearchCursor &a, const SearchCursor &b) {
+            return a.timestamp != b.timestamp ? a.timestamp > b.timestamp : a.file > b.file;
+         };
+         for (const SearchFile &file : files) {
+            pool.request(file.firstTask);
+         }
+         for (const SearchFile &file : files) {
+            if (file.firstTask + 1 < file.endTask) {
+               pool.request(file.firstTask + 1);
+            }
+         }
+         std::vector<SearchCursor> heap;
+         for (size_t f = 0; f < files.size(); f++) {
+            SearchCursor cursor{f, files[f].firstTask, 0, 0};
+            if (nextLine(cursor)) {
+               heap.push_back(cursor);
+               std::push_heap(heap.begin(), heap.end(), later);
+            }
+         }
+         while (!heap.empty()) {
+            std::pop_heap(heap.begin(), heap.end(), later);
+            SearchCursor &cursor = heap.back();
+            printLine(tasks[cursor.task], tasks[cursor.task].hits[cursor.hit]);
+            cursor.hit++;
+            if (nextLine(cursor)) {
+               std::push_heap(heap.begin(), heap.end(), later);
+            } else {
+               heap.pop_back();
+            }
+         }
       }
    }
+   sink.flush();
+   std::cout << "********* SEARCHED " << files.size() << " files (" << bytes / (1024 * 1024) << " MB) in "
+             << Statistics::micros(perf_counter() - started) / 1000 << " ms, " << printed << " lines matched" << std::endl;
+   return 0;
 }
 
 unsigned __stdcall workerThreadProc(void* userData) {
@@ -509,29 +2585,94 @@ unsigned __stdcall workerThreadProc(void* userData) {
    // copy data to local variables just in case the data object goes out of scope
    // (main thread exits early)
    fs::path   logdir = pdata->logdir;
-   std::regex filename_regex = pdata->filename_regex;
-   std::regex beep_regex = pdata->beep_regex;
-   std::regex *pbeep_regex = pdata->beepOnException ? &(beep_regex) : nullptr;
+   std::shared_ptr<const std::regex> filename_regex = pdata->filename_regex;
+   std::shared_ptr<const std::regex> beep_regex = pdata->beep_regex;
+   LineLayout layout = pdata->layout;
+   SystemClock clock;
+   SystemFileSystem fileSystem;
+   TailContext ctx;
+   ctx.pclock = &clock;
+   ctx.pfs = &fileSystem;
+   ctx.stats.started = ctx.stats.reported = clock.tickCount();
+   ctx.playout = &layout;
+   ctx.pbeep_regex = pdata->beepOnException ? beep_regex.get() : nullptr;
+   ctx.bypassCache = pdata->bypassCache;
+   ctx.mapLargeReads = pdata->mapLargeReads;
+   if (ctx.mapLargeReads && !is_local_fixed_drive(logdir)) {
+      // only the prefault of a view is guarded, an in-page error while its lines are split would end the process
+      std::cout << "********* " << logdir << " is not on a local fixed drive, reading large ranges with ReadFile instead of --mmap" << std::endl;
+      ctx.mapLargeReads = false;
+   }
+   ctx.showPrefix = pdata->showPrefix;
+   ctx.drainMillis = pdata->drainMillis;
+   ctx.partialMillis = pdata->partialMillis;
+   ctx.levelMask = pdata->levelMask;
+   ctx.recordRule = pdata->recordRule;
+   std::shared_ptr<const LineFilter> filter = pdata->filter;
+   ctx.pfilter = filter.get();
+   std::unique_ptr<RepeatFilter> repeats;
+   if (pdata->repeatWindowMillis > 0) {
+      repeats.reset(new RepeatFilter(clock, pdata->repeatWindowMillis));
+      ctx.prepeats = repeats.get();
+   }
    int max_files = pdata->max_files;
    DWORD millis = POLLING_INTERVAL_MILLIS;
+   std::unique_ptr<OverlappedReader> reader;
+   if (pdata->overlappedIo) {
+      reader.reset(new OverlappedReader());
+      if (!reader->isValid()) {
+         std::cout << "********* Unable to create I/O completion port, using synchronous reads: " << get_last_error() << std::endl;
+         reader.reset();
+      }
+   }
+   ctx.preader = reader.get();
+   std::unique_ptr<MergeQueue> merge;
+   if (pdata->mergeWindowMillis > 0) {
+      merge.reset(new MergeQueue(layout.getTimestampFormat(), clock, pdata->mergeWindowMillis));
+      ctx.pmerge = merge.get();
+   }
+   ctx.rawPassthrough = !ctx.showPrefix && ctx.pbeep_regex == nullptr && ctx.pmerge == nullptr && ctx.levelMask == ALL_LEVELS
+                        && ctx.recordRule == RecordRule::None && ctx.partialMillis == 0
+                        && ctx.pfilter == nullptr && ctx.prepeats == nullptr && !ctx.sink.isConsole();
+
+   fs::path statsFile = pdata->statsFile;
+   ULONGLONG statsInterval = pdata->statsIntervalMillis;
+   ctx.stats.latency = pdata->latency;
+   if (ctx.stats.latency) {
+      ctx.sink.setWriteLatency(&ctx.stats.writeLatency);
+   }
 
-   std::shared_ptr<PrefixLogFileInfoMap> pmap = collectInitialLogFiles(logdir,filename_regex,max_files);
+   size_t listed = 0;
+   int64_t scanStart = perf_counter();
+   std::shared_ptr<PrefixLogFileInfoMap> pmap = collectInitialLogFiles(logdir,*filename_regex,max_files,fileSystem,clock,&listed,
+                                                                       pdata->seekSince ? &layout.getTimestampFormat() : nullptr, pdata->since);
+   ctx.stats.addScan(perf_counter() - scanStart);
+   if (pdata->startTicks != 0) {
+      std::cout << "********* TIMING: first watch after " << Statistics::micros(perf_counter() - pdata->startTicks) << " us (patterns "
+                << Statistics::micros(pdata->patternTicks) << " us, scan of " << listed << " files "
+                << Statistics::micros(ctx.stats.scanLast) << " us)" << std::endl;
+      ctx.startTicks = pdata->startTicks;
+   }
    if(pmap) {
       while (pGlobalData.load() != nullptr) {
          int signal = pGlobalData.load()->signal.exchange(0);
          if ((signal & STOP_MONITORING) != 0) {
             break;
          }
-         if ((signal & DIRECTORY_MODIFIED) != 0) {
-            std::shared_ptr<PrefixLogFileInfoMap> pNewMap = collectLogFiles(logdir, filename_regex);
-            updateLogFilesMap(pmap, pNewMap, max_files);
+         pollFiles(pmap, (signal & DIRECTORY_MODIFIED) != 0, logdir, *filename_regex, max_files, ctx);
+         if ((signal & DUMP_STATISTICS) != 0 || (statsInterval > 0 && clock.tickCount() - ctx.stats.reported >= statsInterval)) {
+            reportStatistics(pmap, ctx, statsFile);
          }
-         tailAllFiles(pmap,pbeep_regex);
          GlobalData *p = pGlobalData.load();
          if ((p == nullptr || (p->signal.load() & STOP_MONITORING) != 0)) {
             break;
          }
-         Sleep(millis);
+         // with merged output wake up early enough to release the held lines on time
+         Sleep(ctx.pmerge != nullptr ? ctx.pmerge->millisUntilDue(millis) : millis);
+      }
+      flushHeldLines(pmap, ctx);
+      if (statsInterval > 0 || !statsFile.empty() || ctx.stats.latency) {
+         reportStatistics(pmap, ctx, statsFile);
       }
    }
    return 0;
@@ -598,9 +2739,14 @@ int mainThreadProc(Options *pOptions) {
 BOOL WINAPI windowsCtrlHandler(DWORD fdwCtrlType) {
    switch (fdwCtrlType) {
       // Handle the CTRL-C signal.
+   case CTRL_BREAK_EVENT:
+      // the worker thread prints its statistics after the current pass
+      if (pGlobalData.load() != nullptr) {
+         pGlobalData.load()->signal |= DUMP_STATISTICS;
+      }
+      return TRUE;
    case CTRL_C_EVENT:
    case CTRL_CLOSE_EVENT:
-   case CTRL_BREAK_EVENT:
    case CTRL_LOGOFF_EVENT:
    case CTRL_SHUTDOWN_EVENT:
       std::cout << "********* Shutdown in CTRL-C handler" << std::endl;
@@ -632,7 +2778,16 @@ bool installExitHandlers() {
    return stat;
 }
 
+#ifndef TAILER_NO_TRACE
+// {BE6EA449-C2D7-456F-80CB-5E15A8621E2A}, see Trace.h
+TRACELOGGING_DEFINE_PROVIDER(tailerTraceProvider, "Tailer",
+                             (0xbe6ea449, 0xc2d7, 0x456f, 0x80, 0xcb, 0x5e, 0x15, 0xa8, 0x62, 0x1e, 0x2a));
+#endif
+
+// simbench includes this file to run the polling loop against a simulated file system
+#ifndef TAILER_NO_MAIN
 int main(int argc, char *argv[]) {
+   int64_t started = perf_counter();
    int stat = 0;
    Args args(argc, argv);
    auto logdir = fs::path(args.getDir());
@@ -656,13 +2811,66 @@ int main(int argc, char *argv[]) {
       if (beepOnException) {
          std::cout << "Beep if line matches: " << beep_pat << std::endl;
       }
+      std::string timestamp_fmt = args.getTimestampFormat();
+      std::string layout_desc = args.getLineLayout();
+      if (timestamp_fmt.empty()) timestamp_fmt = "%Y-%m-%d %H:%M:%S,%f";      // 2022-02-16 18:51:11,673
+      if (layout_desc.empty()) layout_desc = "%T %L [%t] - %m";                // <timestamp> INFO [main] - message
+      if (args.getMergeWindowMillis() > 0) {
+         std::cout << "Merge by timestamp:   " << timestamp_fmt << std::endl;
+      }
       try {
-         std::regex filename_regex(line_pat);
-         std::regex beep_regex(beep_pat);
-         if (installExitHandlers()) {
+         // compiled once here and shared with the worker thread, which only reads them
+         int64_t compileStart = perf_counter();
+         std::shared_ptr<const std::regex> filename_regex(new std::regex(line_pat));
+         std::shared_ptr<const std::regex> beep_regex;
+         if (beepOnException) {
+            beep_regex.reset(new std::regex(beep_pat));
+         }
+         int64_t patternTicks = perf_counter() - compileStart;
+         LineLayout line_layout(layout_desc, TimestampFormat(timestamp_fmt));
+         unsigned levelMask = level_mask(args.getMinLevel(), args.getLevels());
+         RecordRule recordRule = parse_record_rule(args.getRecordRule());
+         fs::path stats_file(args.getStatsFile());
+         std::shared_ptr<const LineFilter> filter(new LineFilter(args.getFilter(), args.getIncludes(), args.getExcludes()));
+         if (filter->isEmpty()) {
+            filter.reset();
+         } else {
+            std::cout << "Line filter:          " << filter->getSource() << std::endl;
+         }
+         if (levelMask != ALL_LEVELS) {
+            if (!line_layout.hasLevel()) {
+               throw std::invalid_argument("the line layout has no %L field to filter on");
+            }
+            std::string min_level = args.getMinLevel();
+            std::string levels = args.getLevels();
+            std::cout << "Level filter:         " << (min_level.empty() ? "" : ">= " + min_level)
+                      << (min_level.empty() || levels.empty() ? "" : ", ") << levels << std::endl;
+         }
+         std::string since_time = args.getSince();
+         int64_t since = 0;
+         if (!since_time.empty()) {
+            if (!parse_since(since_time, local_time_millis(), since)) {
+               throw std::invalid_argument("unrecognized --since time '" + since_time + "'");
+            }
+            std::cout << "Tailing since:        " << since_time << std::endl;
+         }
+         std::string search_pat = args.getSearch();
+         if (!search_pat.empty()) {
+            SearchPattern pattern(search_pat);
+            std::cout << "Search pattern:       " << search_pat << std::endl;
+            stat = searchLogFiles(logdir, *filename_regex, pattern, args.getShowPrefix(),
+                                  args.getMergeWindowMillis() > 0 ? &line_layout.getTimestampFormat() : nullptr);
+         } else if (installExitHandlers()) {
             unsigned maxFiles = (unsigned)args.getMaxFiles();
-            Options options{logdir, filename_regex, beep_regex, beepOnException, maxFiles};
+            Options options{logdir, filename_regex, beep_regex, beepOnException, maxFiles, args.getOverlapped(), args.getNoCache(), args.getMmap(),
+                            args.getShowPrefix(), args.getDrainMillis(),
+                            args.getPartialMillis(), args.getMergeWindowMillis(), line_layout, levelMask,
+                            recordRule, filter, args.getDedupMillis(), args.getStatsIntervalMillis(), stats_file,
+                            args.getLatency(), args.getTiming() ? started : 0, patternTicks,
+                            !since_time.empty(), since};
+            TRACE_REGISTER();
             stat = mainThreadProc(&options);
+            TRACE_UNREGISTER();
          }
          else {
             stat = 3;
@@ -674,6 +2882,11 @@ int main(int argc, char *argv[]) {
          stat = 2;
          std::cout << "Invalid pattern: " << e.what() << std::endl;
       }
+      catch (std::invalid_argument e) {
+         stat = 2;
+         std::cout << "Invalid argument: " << e.what() << std::endl;
+      }
    }
    return stat;
 }
+#endif